@@ -0,0 +1,1226 @@
+// Bezier.cpp - GL-free bicubic Bezier patch
+
+#include <algorithm>
+#include <mutex>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "Bezier.h"
+#include "Schedule.h"
+
+// Evaluation
+
+static vec3 BezTangent(float t, vec3 &b1, vec3 &b2, vec3 &b3, vec3 &b4) {
+    float t2 = t*t, t3 = t*t2;
+	vec3 p = (-3*t2+6*t-3)*b1+(9*t2-12*t+3)*b2+(6*t-9*t2)*b3+3*t2*b4;
+    return normalize(p);
+}
+
+static vec3 BezPoint(float t, vec3 &b1, vec3 &b2, vec3 &b3, vec3 &b4) {
+    float t2 = t*t, t3 = t*t2;
+    return vec3((-t3+3*t2-3*t+1)*b1+(3*t3-6*t2+3*t)*b2+(3*t2-3*t3)*b3+t3*b4);
+}
+
+vec3 BezierPatch::Point(float s, float t) {
+	vec3 spts[4];
+	SPts(s, spts);
+	return BezPoint(t, spts[0], spts[1], spts[2], spts[3]);
+}
+
+vec3 BezierPatch::Normal(float s, float t) {
+	vec3 spts[4], tpts[4];
+	for (int c = 0; c < 4; c++) {
+		spts[c] = BezPoint(s, pts[0][c].point, pts[1][c].point, pts[2][c].point, pts[3][c].point);
+		tpts[c] = BezPoint(t, pts[c][0].point, pts[c][1].point, pts[c][2].point, pts[c][3].point);
+	}
+	vec3 sTan = BezTangent(s, tpts[0], tpts[1], tpts[2], tpts[3]);
+	vec3 tTan = BezTangent(t, spts[0], spts[1], spts[2], spts[3]);
+	return normalize(cross(sTan, tTan));
+}
+
+void BezierPatch::Eval(float s, float t, vec3 &point, vec3 &sTan, vec3 &tTan, vec3 *normal) {
+	vec3 spts[4], tpts[4];
+	for (int c = 0; c < 4; c++) {
+		spts[c] = BezPoint(s, pts[c][0].point, pts[c][1].point, pts[c][2].point, pts[c][3].point);
+		tpts[c] = BezPoint(t, pts[0][c].point, pts[1][c].point, pts[2][c].point, pts[3][c].point);
+	}
+	point = BezPoint(t, spts[0], spts[1], spts[2], spts[3]);
+	tTan = BezTangent(t, spts[0], spts[1], spts[2], spts[3]); // spts define t-curve
+	sTan = BezTangent(s, tpts[0], tpts[1], tpts[2], tpts[3]); // tpts define s-curve
+	if (normal)
+		*normal = normalize(cross(sTan, tTan));
+}
+
+// Bernstein Basis Tables
+
+struct BezWeights {
+	float b[4];		// cubic Bernstein weights
+	float db[4];	// their derivatives
+};
+
+static vector<BezWeights *> basisTables;	// indexed by res, never moved once built
+static std::mutex basisMutex;				// tessellation may run on several threads
+
+static void SetWeights(BezWeights &w, float t) {
+	float t2 = t*t, t3 = t*t2;
+	w.b[0] = -t3+3*t2-3*t+1;	w.db[0] = -3*t2+6*t-3;
+	w.b[1] = 3*t3-6*t2+3*t;		w.db[1] = 9*t2-12*t+3;
+	w.b[2] = 3*t2-3*t3;			w.db[2] = 6*t-9*t2;
+	w.b[3] = t3;				w.db[3] = 3*t2;
+}
+
+static BezWeights *Basis(int res) {
+	// return weights for res uniform samples in [0,1], computing them on first request
+	std::lock_guard<std::mutex> lock(basisMutex);
+	if ((int) basisTables.size() <= res)
+		basisTables.resize(res+1, NULL);
+	if (!basisTables[res]) {
+		BezWeights *table = new BezWeights[res];
+		for (int i = 0; i < res; i++)
+			SetWeights(table[i], (float) i/(res-1));
+		basisTables[res] = table;
+	}
+	return basisTables[res];
+}
+
+static vec3 Sum4(float w[4], vec3 p[4]) {
+	return w[0]*p[0]+w[1]*p[1]+w[2]*p[2]+w[3]*p[3];
+}
+
+// Batch Evaluation
+
+#if defined(__AVX__)
+	#include <immintrin.h>
+	#define BATCH_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define BATCH_SSE
+#endif
+
+#if defined(BATCH_AVX)
+struct Lanes {
+	// eight floats evaluated together
+	enum {N = 8};
+	__m256 v;
+	Lanes() { }
+	Lanes(__m256 v) : v(v) { }
+	Lanes(float f) : v(_mm256_set1_ps(f)) { }
+};
+inline Lanes operator+(Lanes a, Lanes b) { return _mm256_add_ps(a.v, b.v); }
+inline Lanes operator-(Lanes a, Lanes b) { return _mm256_sub_ps(a.v, b.v); }
+inline Lanes operator*(Lanes a, Lanes b) { return _mm256_mul_ps(a.v, b.v); }
+inline Lanes operator/(Lanes a, Lanes b) { return _mm256_div_ps(a.v, b.v); }
+inline Lanes Sqrt(Lanes a) { return _mm256_sqrt_ps(a.v); }
+inline Lanes Load(const float *f) { return _mm256_loadu_ps(f); }
+inline void Store(Lanes a, float *f) { _mm256_storeu_ps(f, a.v); }
+#elif defined(BATCH_SSE)
+struct Lanes {
+	// four floats evaluated together
+	enum {N = 4};
+	__m128 v;
+	Lanes() { }
+	Lanes(__m128 v) : v(v) { }
+	Lanes(float f) : v(_mm_set1_ps(f)) { }
+};
+inline Lanes operator+(Lanes a, Lanes b) { return _mm_add_ps(a.v, b.v); }
+inline Lanes operator-(Lanes a, Lanes b) { return _mm_sub_ps(a.v, b.v); }
+inline Lanes operator*(Lanes a, Lanes b) { return _mm_mul_ps(a.v, b.v); }
+inline Lanes operator/(Lanes a, Lanes b) { return _mm_div_ps(a.v, b.v); }
+inline Lanes Sqrt(Lanes a) { return _mm_sqrt_ps(a.v); }
+inline Lanes Load(const float *f) { return _mm_loadu_ps(f); }
+inline void Store(Lanes a, float *f) { _mm_storeu_ps(f, a.v); }
+#endif
+
+inline float Sqrt(float a) { return sqrt(a); }
+
+struct ControlNet {
+	float c[3][16];		// x, y, z of the control points, pts[a][b] at index 4*a+b
+};
+
+template <class F>
+static void BezWeights4(F t, F b[4], F db[4]) {
+	F t2 = t*t, t3 = t*t2;
+	b[0] = F(3.f)*t2-t3-F(3.f)*t+F(1.f);	db[0] = F(6.f)*t-F(3.f)*t2-F(3.f);
+	b[1] = F(3.f)*t3-F(6.f)*t2+F(3.f)*t;	db[1] = F(9.f)*t2-F(12.f)*t+F(3.f);
+	b[2] = F(3.f)*t2-F(3.f)*t3;				db[2] = F(6.f)*t-F(9.f)*t2;
+	b[3] = t3;								db[3] = F(3.f)*t2;
+}
+
+template <class F>
+static void Normalize3(F v[3]) {
+	F len = Sqrt(v[0]*v[0]+v[1]*v[1]+v[2]*v[2]);
+	for (int c = 0; c < 3; c++)
+		v[c] = v[c]/len;
+}
+
+template <class F>
+static void EvalLanes(ControlNet &net, F s, F t, F point[3], F sTan[3], F tTan[3], F normal[3]) {
+	// as BezierPatch::Eval, for each lane of s and t
+	F bs[4], dbs[4], bt[4], dbt[4];
+	BezWeights4(s, bs, dbs);
+	BezWeights4(t, bt, dbt);
+	for (int c = 0; c < 3; c++) {
+		float *q = net.c[c];
+		F p(0.f), ds(0.f), dt(0.f);
+		for (int a = 0; a < 4; a++, q += 4) {
+			F row = bs[0]*F(q[0])+bs[1]*F(q[1])+bs[2]*F(q[2])+bs[3]*F(q[3]);
+			F drow = dbs[0]*F(q[0])+dbs[1]*F(q[1])+dbs[2]*F(q[2])+dbs[3]*F(q[3]);
+			p = p+bt[a]*row;
+			dt = dt+dbt[a]*row;
+			ds = ds+bt[a]*drow;
+		}
+		point[c] = p;
+		sTan[c] = ds;
+		tTan[c] = dt;
+	}
+	Normalize3(sTan);
+	Normalize3(tTan);
+	if (normal) {
+		normal[0] = sTan[1]*tTan[2]-sTan[2]*tTan[1];
+		normal[1] = sTan[2]*tTan[0]-sTan[0]*tTan[2];
+		normal[2] = sTan[0]*tTan[1]-sTan[1]*tTan[0];
+		Normalize3(normal);
+	}
+}
+
+void BezierPatch::EvalBatch(int n, const float *s, const float *t, vec3 *points, vec3 *sTans, vec3 *tTans, vec3 *normals) {
+	ControlNet net;
+	for (int k = 0; k < 16; k++)
+		for (int c = 0; c < 3; c++)
+			net.c[c][k] = pts[k/4][k%4].point[c];
+	vec3 *outs[] = {points, sTans, tTans, normals};
+	int k = 0;
+#if defined(BATCH_AVX) || defined(BATCH_SSE)
+	for (; k+Lanes::N <= n; k += Lanes::N) {
+		Lanes results[4][3];
+		float lanes[3][Lanes::N];
+		EvalLanes(net, Load(s+k), Load(t+k), results[0], results[1], results[2], normals? results[3] : NULL);
+		// transpose lanes into caller's arrays of vec3
+		for (int o = 0; o < 4; o++)
+			if (outs[o]) {
+				for (int c = 0; c < 3; c++)
+					Store(results[o][c], lanes[c]);
+				for (int l = 0; l < Lanes::N; l++)
+					outs[o][k+l] = vec3(lanes[0][l], lanes[1][l], lanes[2][l]);
+			}
+	}
+#endif
+	// scalar fallback, and remainder of a SIMD batch
+	for (; k < n; k++) {
+		float results[4][3];
+		EvalLanes(net, s[k], t[k], results[0], results[1], results[2], normals? results[3] : NULL);
+		for (int o = 0; o < 4; o++)
+			if (outs[o])
+				outs[o][k] = vec3(results[o][0], results[o][1], results[o][2]);
+	}
+}
+
+// Initialization
+
+void BezierPatch::SetRes(int res) {
+	this->res = res;
+	topology = GetTopology(res);
+	Tessellate();
+}
+
+void BezierPatch::Init(int res, vec3 p0,  vec3 p1,  vec3 p2,  vec3 p3,
+		                        vec3 p4,  vec3 p5,  vec3 p6,  vec3 p7, 
+					            vec3 p8,  vec3 p9,  vec3 p10, vec3 p11,
+					            vec3 p12, vec3 p13, vec3 p14, vec3 p15) {
+    vec3 *tmp[] = {&p0, &p1, &p2,  &p3,  &p4,  &p5,  &p6,  &p7,
+		           &p8, &p9, &p10, &p11, &p12, &p13, &p14, &p15};
+	for (int i = 0; i < 16; i++){
+		pts[i / 4][i % 4].point = *(tmp[i]);
+	}
+	SetControlSegments();
+	SetRes(res);
+}
+
+void BezierPatch::Init(int res, vec3 p0, vec3 p1, vec3 p2, vec3 p3) {
+	float vals[] = {0, 1/3.f, 2/3.f, 1.};
+	for (int i = 0; i < 16; i++) {
+		float ax = vals[i%4], ay = vals[i/4];
+		vec3 p10 = p0+ax*(p1-p0), p32 = p2+ax*(p3-p2);
+		pts[i / 4][i % 4].point = p10 + ay*(p32 - p10);
+	}
+	SetControlSegments();
+	SetRes(res);
+}
+
+void BezierPatch::SPts(float s, vec3 spts[]) {
+	for (int c = 0; c < 4; c++)
+		spts[c] = BezPoint(s, pts[c][0].point, pts[c][1].point, pts[c][2].point, pts[c][3].point);
+}
+
+void BezierPatch::TPts(float t, vec3 tpts[]) {
+	// set tpts[0..3] each t-distance along the 4 t-curves; in other words, tpts[] defines an s-curve
+	for (int c = 0; c < 4; c++)
+		tpts[c] = BezPoint(t, pts[0][c].point, pts[1][c].point, pts[2][c].point, pts[3][c].point);
+}
+
+void BezierPatch::Tessellate() {
+	if (sampleMode == CurvatureSamples)
+		PlaceSamples();
+	vertices.resize(res*res);
+	normals.resize(res*res);
+	Tessellate(&vertices[0], &normals[0]);
+	dirtyPoints = 0;
+	version++;
+}
+
+void BezierPatch::Tessellate(vec3 *vertices, vec3 *normals) {
+	TessellateBasis(vertices, normals);
+}
+
+void BezierPatch::TessellateBasis(vec3 *vPtr, vec3 *nPtr) {
+	// set res by res vertices as a tensor contraction of the control net with cached weights
+	// (or weights for sSamples, tSamples)
+	BezWeights *sBasis = Basis(res), *tBasis = sBasis;
+	vector<BezWeights> sWeights, tWeights;
+	if (sampleMode == CurvatureSamples && (int) sSamples.size() == res && (int) tSamples.size() == res) {
+		sWeights.resize(res);
+		tWeights.resize(res);
+		for (int i = 0; i < res; i++) {
+			SetWeights(sWeights[i], sSamples[i]);
+			SetWeights(tWeights[i], tSamples[i]);
+		}
+		sBasis = &sWeights[0];
+		tBasis = &tWeights[0];
+	}
+	vec3 spts[4], dspts[4];
+	for (int i = 0; i < res; i++) {
+		BezWeights &ws = sBasis[i];
+		for (int c = 0; c < 4; c++) {
+			patchPoints *row = pts[c];
+			spts[c] = ws.b[0]*row[0].point+ws.b[1]*row[1].point+ws.b[2]*row[2].point+ws.b[3]*row[3].point;
+			dspts[c] = ws.db[0]*row[0].point+ws.db[1]*row[1].point+ws.db[2]*row[2].point+ws.db[3]*row[3].point;
+		}
+		// spts define a t-curve, dspts its derivative in s
+		vec3 *n = nPtr;
+		for (int j = 0; j < res; j++) {
+			BezWeights &wt = tBasis[j];
+			vec3 sTan = Sum4(wt.b, dspts);
+			vec3 tTan = Sum4(wt.db, spts);
+			*vPtr++ = Sum4(wt.b, spts);
+			*nPtr++ = cross(sTan, tTan);
+		}
+		// normalize the row in a separate pass, which the compiler vectorizes
+		for (int j = 0; j < res; j++)
+			n[j] = normalize(n[j]);
+	}
+}
+
+// Topology
+
+static vector<Topology *> topologies;	// indexed by res, shared by all patches of that res
+static std::mutex topologyMutex;
+static TriangleOrder triangleOrder = RowOrder;	// for topologies built next
+
+Topology *GetTopology(int res) {
+	std::lock_guard<std::mutex> lock(topologyMutex);
+	if ((int) topologies.size() <= res)
+		topologies.resize(res+1, NULL);
+	if (!topologies[res]) {
+		Topology *t = new Topology;
+		t->res = res;
+		t->order = triangleOrder;
+		t->SetTriangles();
+		topologies[res] = t;
+	}
+	return topologies[res];
+}
+
+void SetTriangleOrder(TriangleOrder order) {
+	std::lock_guard<std::mutex> lock(topologyMutex);
+	triangleOrder = order;
+	for (int res = 0; res < (int) topologies.size(); res++)
+		if (topologies[res] && topologies[res]->order != order) {
+			topologies[res]->order = order;
+			topologies[res]->SetTriangles();
+		}
+}
+
+void Topology::SetTriangles() {
+	// row order, then reordered unless order is RowOrder
+	int tri = 0;
+	triangles.resize(2*(res-1)*(res-1));
+	for (int j1 = 1; j1 < res; j1++)
+		for (int i1 = 1; i1 < res; i1++) {
+			int i0 = i1-1, j0 = j1-1;
+			int v1 = j0*res+i0, v2 = j0*res+i1, v3 = j1*res+i1, v4 = j1*res+i0;
+			triangles[tri++] = int3(v1, v2, v3);
+			triangles[tri++] = int3(v1, v3, v4);
+		}
+	OrderTriangles(order, triangles, res*res);
+	SetStrips();
+	SetSegments();
+}
+
+void Topology::SetStrips() {
+	// per row of quads j1-1 to j1: each column's vertex in row j1, then in row j1-1, so that
+	// strip triangles have the winding and diagonals of the row-order list
+	strips.resize(0);
+	for (int j1 = 1; j1 < res; j1++) {
+		if (j1 > 1)
+			strips.push_back(RestartIndex);
+		for (int i = 0; i < res; i++) {
+			strips.push_back(j1*res+i);
+			strips.push_back((j1-1)*res+i);
+		}
+	}
+}
+
+static int CompareInt2(const void *arg1, const void *arg2) {
+  int2 *p1 = (int2*) arg1, *p2 = (int2*) arg2;
+  return p1->i1 == p2->i1? (p1->i2 < p2->i2? -1 : 1) : p1->i1 < p2->i1? -1 : 1;
+}
+
+void Topology::SetSegments() {
+	// there are res rows and res columns of res-1 segments
+	int nsegments = 2*res*(res-1), count = 0;
+	segments.resize(nsegments);
+	for (int i = 0; i < res; i++)
+		for (int j = 0; j < res-1; j++)
+			// in row i, add segment from column j to j+1, ie vertex i*(res-1)+j to i*(res-1)+j+1
+			segments[count++] = int2(i*res+j, i*res+j+1);
+	for (int j = 0; j < res; j++)
+		for (int i = 0; i < res-1; i++)
+			// in column j, add segment from row i to row i+1, ie vertex i*(res-1)+j to i*(res-1)+j+res
+			segments[count++] = int2(i*res+j, i*res+j+res);
+}
+
+// Triangle Order
+
+static void TriangleAdjacency(vector<int3> &triangles, int nVerts, vector<int> &first, vector<int> &adj) {
+	// triangles using vertex v are adj[first[v]] to adj[first[v+1]-1]
+	int nTris = triangles.size();
+	first.assign(nVerts+1, 0);
+	for (int t = 0; t < nTris; t++)
+		for (int c = 0; c < 3; c++)
+			first[((int *) &triangles[t])[c]+1]++;
+	for (int v = 0; v < nVerts; v++)
+		first[v+1] += first[v];
+	vector<int> fill(first.begin(), first.end()-1);
+	adj.resize(3*nTris);
+	for (int t = 0; t < nTris; t++)
+		for (int c = 0; c < 3; c++)
+			adj[fill[((int *) &triangles[t])[c]]++] = t;
+}
+
+static void Tipsify(vector<int3> &triangles, int nVerts, int cacheSize) {
+	// fan around a vertex at a time, next choosing a vertex of the fan whose remaining
+	// triangles would still find it in a cache of cacheSize
+	int nTris = triangles.size(), time = cacheSize+1, cursor = 0;
+	vector<int> first, adj;
+	TriangleAdjacency(triangles, nVerts, first, adj);
+	vector<int> live(nVerts), stamp(nVerts, 0), deadEnd, candidates;
+	vector<bool> emitted(nTris, false);
+	vector<int3> out;
+	out.reserve(nTris);
+	for (int v = 0; v < nVerts; v++)
+		live[v] = first[v+1]-first[v];
+	int f = nTris? 0 : -1;
+	while (f >= 0) {
+		candidates.resize(0);
+		for (int a = first[f]; a < first[f+1]; a++) {
+			int t = adj[a], *tv = (int *) &triangles[t];
+			if (emitted[t])
+				continue;
+			for (int c = 0; c < 3; c++) {
+				int v = tv[c];
+				deadEnd.push_back(v);
+				candidates.push_back(v);
+				live[v]--;
+				if (time-stamp[v] > cacheSize)
+					stamp[v] = time++;		// cache miss
+			}
+			out.push_back(triangles[t]);
+			emitted[t] = true;
+		}
+		// oldest candidate that stays cached through its remaining triangles
+		int n = -1, m = -1;
+		for (int i = 0; i < (int) candidates.size(); i++) {
+			int v = candidates[i];
+			if (live[v] <= 0)
+				continue;
+			int p = time-stamp[v]+2*live[v] <= cacheSize? time-stamp[v] : 0;
+			if (p > m) {
+				m = p;
+				n = v;
+			}
+		}
+		// dead end: most recently used vertex with triangles left, else next in input order
+		while (n < 0 && deadEnd.size()) {
+			int d = deadEnd.back();
+			deadEnd.pop_back();
+			if (live[d] > 0)
+				n = d;
+		}
+		for (; n < 0 && cursor < nVerts; cursor++)
+			if (live[cursor] > 0)
+				n = cursor;
+		f = n;
+	}
+	triangles.swap(out);
+}
+
+static const int ForsythCache = 32;		// modelled LRU cache size
+
+static float ForsythScore(int cachePos, int remaining) {
+	// higher for vertices recently used, and for those with few triangles left
+	if (remaining == 0)
+		return -1;
+	float score = 0;
+	if (cachePos >= 0)
+		score = cachePos < 3? .75f : pow(1-(cachePos-3)/(float) (ForsythCache-3), 1.5f);
+	return score+2/sqrt((float) remaining);
+}
+
+static void Forsyth(vector<int3> &triangles, int nVerts) {
+	// greedily emit the triangle of highest vertex score, rescoring only vertices in the cache
+	int nTris = triangles.size();
+	vector<int> first, adj;
+	TriangleAdjacency(triangles, nVerts, first, adj);
+	vector<int> remaining(nVerts), cachePos(nVerts, -1), cache, next;
+	vector<float> vScore(nVerts), tScore(nTris);
+	vector<bool> added(nTris, false);
+	vector<int3> out;
+	out.reserve(nTris);
+	for (int v = 0; v < nVerts; v++) {
+		remaining[v] = first[v+1]-first[v];
+		vScore[v] = ForsythScore(-1, remaining[v]);
+	}
+	for (int t = 0; t < nTris; t++) {
+		int *tv = (int *) &triangles[t];
+		tScore[t] = vScore[tv[0]]+vScore[tv[1]]+vScore[tv[2]];
+	}
+	int best = -1;
+	while ((int) out.size() < nTris) {
+		if (best < 0) {
+			// nothing adjacent to the cache: best triangle overall
+			for (int t = 0; t < nTris; t++)
+				if (!added[t] && (best < 0 || tScore[t] > tScore[best]))
+					best = t;
+		}
+		int *tv = (int *) &triangles[best];
+		out.push_back(triangles[best]);
+		added[best] = true;
+		// move best past the live triangles of its vertices
+		for (int c = 0; c < 3; c++) {
+			int v = tv[c], *a = &adj[first[v]], n = --remaining[v];
+			for (int k = 0; k <= n; k++)
+				if (a[k] == best) {
+					std::swap(a[k], a[n]);
+					break;
+				}
+		}
+		// triangle's vertices to the front of the cache; rescore everything cached or evicted
+		next.assign(tv, tv+3);
+		for (int k = 0; k < (int) cache.size(); k++)
+			if (cache[k] != tv[0] && cache[k] != tv[1] && cache[k] != tv[2])
+				next.push_back(cache[k]);
+		for (int k = 0; k < (int) next.size(); k++) {
+			int v = next[k];
+			cachePos[v] = k < ForsythCache? k : -1;
+			vScore[v] = ForsythScore(cachePos[v], remaining[v]);
+		}
+		best = -1;
+		for (int k = 0; k < (int) next.size(); k++) {
+			int v = next[k];
+			for (int a = first[v]; a < first[v]+remaining[v]; a++) {
+				int t = adj[a], *u = (int *) &triangles[t];
+				tScore[t] = vScore[u[0]]+vScore[u[1]]+vScore[u[2]];
+				if (best < 0 || tScore[t] > tScore[best])
+					best = t;
+			}
+		}
+		next.resize(std::min((int) next.size(), ForsythCache));
+		cache.swap(next);
+	}
+	triangles.swap(out);
+}
+
+void OrderTriangles(TriangleOrder order, vector<int3> &triangles, int nVerts, int cacheSize) {
+	if (order == TipsifyOrder)
+		Tipsify(triangles, nVerts, cacheSize);
+	if (order == ForsythOrder)
+		Forsyth(triangles, nVerts);
+}
+
+float ACMR(int *indices, int nIndices, int cacheSize, bool strip) {
+	vector<int> fifo(cacheSize, Topology::RestartIndex);
+	int misses = 0, nTris = strip? 0 : nIndices/3, run = 0, head = 0;
+	for (int i = 0; i < nIndices; i++) {
+		int v = indices[i];
+		if (strip && v == Topology::RestartIndex) {
+			run = 0;
+			continue;
+		}
+		if (strip && ++run >= 3)
+			nTris++;
+		if (std::find(fifo.begin(), fifo.end(), v) == fifo.end()) {
+			misses++;
+			fifo[head] = v;
+			head = (head+1)%cacheSize;
+		}
+	}
+	return nTris? (float) misses/nTris : 0;
+}
+
+// Dirty Tracking
+
+BezierPatch::BezierPatch() : res(0), topology(NULL), dirtyPoints(AllPoints), version(0),
+							 sampleMode(UniformSamples), blendRes(0), blendK(0) {
+	for (int k = 0; k < 16; k++)
+		pts[k/4][k%4].xresis = pts[k/4][k%4].yresis = 0;
+}
+
+void BezierPatch::SetPoint(int s, int t, vec3 p) {
+	vec3 &point = pts[s][t].point;
+	if (point.x != p.x || point.y != p.y || point.z != p.z) {
+		point = p;
+		MarkDirty(s, t);
+	}
+}
+
+void BezierPatch::MarkDirty(int s, int t) {
+	dirtyPoints |= 1 << (4*s+t);
+}
+
+void BezierPatch::MarkDirty() {
+	dirtyPoints = AllPoints;
+}
+
+bool BezierPatch::IsDirty() {
+	return dirtyPoints != 0;
+}
+
+// Sampling
+
+enum {DensitySteps = 64};
+
+static float SecondDerivative(vec3 &b0, vec3 &b1, vec3 &b2, vec3 &b3, float u) {
+	// |C''(u)| of the cubic b0..b3
+	return length(6*((1-u)*(b0-2*b1+b2)+u*(b1-2*b2+b3)));
+}
+
+static void Density(BezierPatch &p, bool alongS, float density[DensitySteps]) {
+	// surface curves in s (t) are convex combinations of the control net's rows (columns), so
+	// their second derivative is bounded by the rows' (columns'); density is its square root
+	for (int k = 0; k < DensitySteps; k++) {
+		float u = (k+.5f)/DensitySteps, d = 0;
+		for (int c = 0; c < 4; c++)
+			d = std::max(d, alongS?
+				SecondDerivative(p.pts[c][0].point, p.pts[c][1].point, p.pts[c][2].point, p.pts[c][3].point, u) :
+				SecondDerivative(p.pts[0][c].point, p.pts[1][c].point, p.pts[2][c].point, p.pts[3][c].point, u));
+		density[k] = sqrt(d);
+	}
+}
+
+static float MinDensity(float density[DensitySteps]) {
+	// a floor keeps samples in flat spans, where normals may still vary across
+	float mean = 0;
+	for (int k = 0; k < DensitySteps; k++)
+		mean += density[k]/DensitySteps;
+	return .25f*mean+1e-6f;
+}
+
+void BezierPatch::SetSampleMode(SampleMode mode) {
+	sampleMode = mode;
+	if (mode == UniformSamples) {
+		sSamples.resize(0);
+		tSamples.resize(0);
+	}
+	MarkDirty();
+}
+
+void BezierPatch::PlaceSamples() {
+	// an interval of length h departs from the curve by h*h*|C''|/8, so equal error per interval
+	// means equal integrals of sqrt|C''|
+	for (int dir = 0; dir < 2; dir++) {
+		vector<float> &samples = dir == 0? sSamples : tSamples;
+		float density[DensitySteps], cum[DensitySteps+1];
+		Density(*this, dir == 0, density);
+		float minDensity = MinDensity(density);
+		cum[0] = 0;
+		for (int k = 0; k < DensitySteps; k++)
+			cum[k+1] = cum[k]+(density[k]+minDensity)/DensitySteps;
+		samples.resize(res);
+		for (int i = 0, k = 0; i < res; i++) {
+			float target = cum[DensitySteps]*i/(res-1);
+			while (k < DensitySteps-1 && cum[k+1] < target)
+				k++;
+			samples[i] = (k+(target-cum[k])/(cum[k+1]-cum[k]))/DensitySteps;
+		}
+		samples[0] = 0;
+		samples[res-1] = 1;
+	}
+}
+
+float BezierPatch::ChordError(int res) {
+	// sum of the estimates in s and t, treating density as constant across an interval: uniform
+	// intervals get the peak density; curvature samples, spaced as PlaceSamples by density plus
+	// floor, get its integral scaled by the largest density/(density+floor)
+	float n = (float) std::max(1, res-1), error = 0;
+	for (int dir = 0; dir < 2; dir++) {
+		float density[DensitySteps], peak = 0, integral = 0, ratio = 0;
+		Density(*this, dir == 0, density);
+		float minDensity = MinDensity(density);
+		for (int k = 0; k < DensitySteps; k++) {
+			peak = std::max(peak, density[k]);
+			integral += (density[k]+minDensity)/DensitySteps;
+			ratio = std::max(ratio, density[k]/(density[k]+minDensity));
+		}
+		float d = sampleMode == CurvatureSamples? integral*ratio : peak;
+		error += d*d/(8*n*n);
+	}
+	return error;
+}
+
+void BudgetRes(BezierPatch **patches, int npatches, int vertexBudget, int *res, int maxRes) {
+	// start coarsest; refine the patch of largest error whose next res fits, until none does
+	int total = 4*npatches;
+	for (int i = 0; i < npatches; i++)
+		res[i] = 2;
+	if (total >= vertexBudget)
+		return;		// the floor, even if over budget
+	vector<bool> full(npatches, false);
+	for (;;) {
+		int worst = -1;
+		float worstError = 0;
+		for (int i = 0; i < npatches; i++) {
+			float e = full[i]? 0 : patches[i]->ChordError(res[i]);
+			if (e > worstError) {
+				worst = i;
+				worstError = e;
+			}
+		}
+		if (worst < 0)
+			break;
+		int r = res[worst], next = 2*r-1, grow = next*next-r*r;
+		if (next > maxRes || total+grow > vertexBudget)
+			full[worst] = true;
+		else {
+			res[worst] = next;
+			total += grow;
+		}
+	}
+}
+
+// Curvature Correction
+
+void BezierPatch::Curve(float movex, float movey) {
+	// displace each control point from its original position, in proportion to its resistance
+	for (int k = 0; k < 16; k++) {
+		patchPoints &p = pts[k / 4][k % 4];
+		SetPoint(k / 4, k % 4, vec3(p.origPoint.x-movex*p.xresis, p.origPoint.y+movey*p.yresis, p.origPoint.z));
+	}
+}
+
+void BezierPatch::Reset() {
+	for (int k = 0; k < 16; k++)
+		SetPoint(k / 4, k % 4, pts[k / 4][k % 4].origPoint);
+}
+
+bool BezierPatch::Curves() {
+	for (int k = 0; k < 16; k++)
+		if (pts[k / 4][k % 4].xresis != 0 || pts[k / 4][k % 4].yresis != 0)
+			return true;
+	return false;
+}
+
+// Curvature Blend
+
+static void TangentGrids(vec3 net[4][4], int res, vec3 *points, vec3 *sTans, vec3 *tTans) {
+	// as TessellateBasis, for an arbitrary control net, leaving tangents unnormalized
+	BezWeights *basis = Basis(res);
+	vec3 spts[4], dspts[4];
+	for (int i = 0; i < res; i++) {
+		BezWeights &ws = basis[i];
+		for (int c = 0; c < 4; c++) {
+			spts[c] = Sum4(ws.b, net[c]);
+			dspts[c] = Sum4(ws.db, net[c]);
+		}
+		for (int j = 0; j < res; j++) {
+			BezWeights &wt = basis[j];
+			*points++ = Sum4(wt.b, spts);
+			*sTans++ = Sum4(wt.b, dspts);
+			*tTans++ = Sum4(wt.db, spts);
+		}
+	}
+}
+
+void BezierPatch::SetBlend(float xscale, float yscale) {
+	// Curve and Bezier evaluation are linear in the control points, so the curved surface is
+	// base+k*delta, where base is tessellated from the original points and delta from the
+	// displacement for k = 1; tangents are linear in k, so their cross product is quadratic
+	int nVerts = res*res;
+	vec3 baseNet[4][4], deltaNet[4][4];
+	for (int k = 0; k < 16; k++) {
+		patchPoints &p = pts[k / 4][k % 4];
+		baseNet[k / 4][k % 4] = p.origPoint;
+		deltaNet[k / 4][k % 4] = vec3(-xscale*p.xresis, yscale*p.yresis, 0);
+	}
+	vector<vec3> sTan0(nVerts), tTan0(nVerts), sTan1(nVerts), tTan1(nVerts);
+	blendBase.resize(nVerts);
+	blendDelta.resize(nVerts);
+	TangentGrids(baseNet, res, &blendBase[0], &sTan0[0], &tTan0[0]);
+	TangentGrids(deltaNet, res, &blendDelta[0], &sTan1[0], &tTan1[0]);
+	for (int c = 0; c < 3; c++)
+		blendCross[c].resize(nVerts);
+	for (int i = 0; i < nVerts; i++) {
+		blendCross[0][i] = cross(sTan0[i], tTan0[i]);
+		blendCross[1][i] = cross(sTan0[i], tTan1[i])+cross(sTan1[i], tTan0[i]);
+		blendCross[2][i] = cross(sTan1[i], tTan1[i]);
+	}
+	blendScale = vec2(xscale, yscale);
+	blendRes = res;
+}
+
+void BezierPatch::BlendPoints(float k) {
+	if (blendRes != res)
+		SetBlend(blendScale.x, blendScale.y);
+	for (int i = 0; i < 16; i++) {
+		patchPoints &p = pts[i / 4][i % 4];
+		p.point = vec3(p.origPoint.x-k*blendScale.x*p.xresis, p.origPoint.y+k*blendScale.y*p.yresis, p.origPoint.z);
+	}
+	blendK = k;
+	dirtyPoints = 0;
+}
+
+void BezierPatch::Blend(float k) {
+	BlendPoints(k);
+	if (sampleMode != UniformSamples) {
+		Tessellate();	// grids are uniformly sampled
+		return;
+	}
+	int nVerts = res*res;
+	vertices.resize(nVerts);
+	normals.resize(nVerts);
+	vec3 *base = &blendBase[0], *delta = &blendDelta[0];
+	vec3 *c0 = &blendCross[0][0], *c1 = &blendCross[1][0], *c2 = &blendCross[2][0];
+	for (int i = 0; i < nVerts; i++) {
+		vertices[i] = base[i]+k*delta[i];
+		normals[i] = normalize(c0[i]+k*(c1[i]+k*c2[i]));
+	}
+	version++;
+}
+
+// Accuracy and Speed
+
+static float TimePerCall(BezierPatch &p, vec3 *vertices, vec3 *normals, bool eval) {
+	// average seconds per tessellation, by per-sample BezierPatch::Eval if eval
+	int nCalls = 0, res = p.res;
+	double start = Seconds(), elapsed = 0;
+	do {
+		if (eval)
+			for (int i = 0; i < res; i++)
+				for (int j = 0; j < res; j++) {
+					vec3 sTan, tTan;
+					p.Eval((float) i/(res-1), (float) j/(res-1), vertices[i*res+j], sTan, tTan, &normals[i*res+j]);
+				}
+		else
+			p.Tessellate(vertices, normals);
+		nCalls++;
+	} while ((elapsed = Seconds()-start) < .1f);
+	return (float) (elapsed/nCalls);
+}
+
+void TessellationReport(BezierPatch &p, int maxRes) {
+	// uniform samples, as Eval is compared at i/(res-1), j/(res-1)
+	int saveRes = p.res;
+	BezierPatch::SampleMode saveMode = p.sampleMode;
+	p.sampleMode = BezierPatch::UniformSamples;
+	vec3 lo = p.pts[0][0].point, hi = lo;
+	for (int k = 1; k < 16; k++)
+		for (int c = 0; c < 3; c++) {
+			lo[c] = std::min(lo[c], p.pts[k/4][k%4].point[c]);
+			hi[c] = std::max(hi[c], p.pts[k/4][k%4].point[c]);
+		}
+	float size = length(hi-lo);
+	printf("tessellation vs BezierPatch::Eval (control hull diagonal %g)\n", size);
+	printf("  res   eval(ms) basis(ms) basis pos err (rel)  basis normal err (deg)\n");
+	for (int res = 10; res <= maxRes; res *= 2) {
+		int nVerts = res*res;
+		vector<vec3> ev(nVerts), en(nVerts), bv(nVerts), bn(nVerts);
+		p.res = res;
+		float tEval = TimePerCall(p, &ev[0], &en[0], true);
+		float tBasis = TimePerCall(p, &bv[0], &bn[0], false);
+		float posErr = 0, angErr = 0;
+		for (int k = 0; k < nVerts; k++) {
+			float chord = length(bn[k]-en[k]); // better conditioned than acos of dot near 0
+			posErr = std::max(posErr, length(bv[k]-ev[k]));
+			if (chord == chord) // skip degenerate normals
+				angErr = std::max(angErr, 2*std::asin(std::min(1.f, chord/2))/DegreesToRadians);
+		}
+		printf("  %-5i %-8.3f %-9.3f %-9.2e (%.1e)    %.2e\n",
+			res, 1000*tEval, 1000*tBasis, posErr, size > 0? posErr/size : 0, angErr);
+	}
+	p.res = saveRes;
+	p.sampleMode = saveMode;
+}
+
+void ACMRReport(int maxRes, int cacheSize) {
+	printf("average cache miss ratio, FIFO of %i vertices (reorder time)\n", cacheSize);
+	printf("  res   row    tipsify          forsyth          strips\n");
+	for (int res = 10; res <= maxRes; res *= 2) {
+		Topology t;
+		t.res = res;
+		t.order = RowOrder;
+		t.SetTriangles();
+		vector<int3> tipsify(t.triangles), forsyth(t.triangles);
+		double start = Seconds();
+		OrderTriangles(TipsifyOrder, tipsify, res*res, cacheSize);
+		double tipsified = Seconds();
+		OrderTriangles(ForsythOrder, forsyth, res*res);
+		double tTipsify = tipsified-start, tForsyth = Seconds()-tipsified;
+		int nIndices = 3*t.triangles.size();
+		printf("  %-5i %-6.3f %-6.3f (%5.1f ms) %-6.3f (%5.1f ms) %-6.3f\n", res,
+			ACMR((int *) &t.triangles[0], nIndices, cacheSize),
+			ACMR((int *) &tipsify[0], nIndices, cacheSize), 1000*tTipsify,
+			ACMR((int *) &forsyth[0], nIndices, cacheSize), 1000*tForsyth,
+			ACMR(&t.strips[0], t.strips.size(), cacheSize, true));
+	}
+}
+
+static float GridError(BezierPatch &p, int res, BezierPatch::SampleMode mode) {
+	// largest distance between a cell's bilinear center and the surface at its center parameters
+	p.res = res;
+	p.sampleMode = mode;
+	if (mode == BezierPatch::CurvatureSamples)
+		p.PlaceSamples();
+	vector<vec3> v(res*res), n(res*res);
+	p.Tessellate(&v[0], &n[0]);
+	float error = 0;
+	for (int i = 0; i < res-1; i++)
+		for (int j = 0; j < res-1; j++) {
+			bool uniform = mode == BezierPatch::UniformSamples;
+			float s0 = uniform? (float) i/(res-1) : p.sSamples[i], s1 = uniform? (float) (i+1)/(res-1) : p.sSamples[i+1];
+			float t0 = uniform? (float) j/(res-1) : p.tSamples[j], t1 = uniform? (float) (j+1)/(res-1) : p.tSamples[j+1];
+			vec3 center = .25f*(v[i*res+j]+v[i*res+j+1]+v[(i+1)*res+j]+v[(i+1)*res+j+1]);
+			error = std::max(error, length(center-p.Point(.5f*(s0+s1), .5f*(t0+t1))));
+		}
+	return error;
+}
+
+void SamplingReport(BezierPatch &p, int maxRes) {
+	int saveRes = p.res;
+	BezierPatch::SampleMode saveMode = p.sampleMode;
+	vector<float> saveS(p.sSamples), saveT(p.tSamples);
+	printf("grid error of uniform vs curvature samples (ChordError estimate)\n");
+	printf("  res   uniform             curvature           uniform res to match\n");
+	for (int res = 5; res <= maxRes; res = 2*res-1) {
+		float uniform = GridError(p, res, BezierPatch::UniformSamples), uniformBound = p.ChordError(res);
+		float curvature = GridError(p, res, BezierPatch::CurvatureSamples), curvatureBound = p.ChordError(res);
+		// smallest uniform res as accurate: double, then bisect
+		int lo = res, hi = res;
+		while (hi < 16*maxRes && GridError(p, hi, BezierPatch::UniformSamples) > curvature)
+			lo = hi, hi *= 2;
+		while (lo < hi-1) {
+			int mid = (lo+hi)/2;
+			if (GridError(p, mid, BezierPatch::UniformSamples) > curvature)
+				lo = mid;
+			else
+				hi = mid;
+		}
+		printf("  %-5i %-9.2e (%.1e) %-9.2e (%.1e) %i\n", res, uniform, uniformBound, curvature, curvatureBound, hi);
+	}
+	p.res = saveRes;
+	p.sampleMode = saveMode;
+	p.sSamples = saveS;
+	p.tSamples = saveT;
+}
+
+// Adaptive Resolution
+
+static int NestedRes(float segments, int maxRes) {
+	// smallest 2^k+1 with at least segments grid intervals, at most maxRes
+	int res = 2;
+	while (res < maxRes && res-1 < segments)
+		res = 2*res-1;
+	return std::min(res, maxRes);
+}
+
+int ScreenRes(BezierPatch &p, mat4 &fullview, int width, int height, int currentRes,
+			  float pixelsPerSegment, float tolerance, int maxRes) {
+	vec2 q[4][4];
+	for (int k = 0; k < 16; k++) {
+		vec4 xp = fullview*vec4(p.pts[k/4][k%4].point, 1);
+		if (!(fabs(xp.w) > 1e-6f))
+			return maxRes;		// at the eye plane
+		q[k/4][k%4] = vec2((xp.x/xp.w+1)*.5f*width, (xp.y/xp.w+1)*.5f*height);
+	}
+	// longest projected hull polyline, and largest second difference, in either direction
+	float span = 0, second = 0;
+	for (int a = 0; a < 4; a++) {
+		float la = 0, lb = 0;
+		for (int b = 0; b < 3; b++) {
+			la += length(q[a][b+1]-q[a][b]);
+			lb += length(q[b+1][a]-q[b][a]);
+		}
+		span = std::max(span, std::max(la, lb));
+		for (int b = 0; b < 2; b++) {
+			second = std::max(second, length(q[a][b]-2*q[a][b+1]+q[a][b+2]));
+			second = std::max(second, length(q[b][a]-2*q[b+1][a]+q[b+2][a]));
+		}
+	}
+	// n chords depart from a cubic by at most max|P''|/(8n^2), and |P''| <= 6*second
+	float segments = std::max(span/pixelsPerSegment, sqrt(6*second/(8*tolerance)));
+	int res = NestedRes(segments, maxRes);
+	bool nested = currentRes > 1 && ((currentRes-1) & (currentRes-2)) == 0;
+	if (nested && res < currentRes && NestedRes(1.25f*segments, maxRes) >= currentRes)
+		res = currentRes;
+	return res;
+}
+
+static vec3 &EdgePoint(BezierPatch *p, int edge, int m) {
+	return edge == 0? p->pts[0][m].point : edge == 1? p->pts[3][m].point :
+		   edge == 2? p->pts[m][0].point : p->pts[m][3].point;
+}
+
+static int EdgeVertex(int res, int edge, int q) {
+	// index of the q'th vertex along edge, in the direction of its control points
+	return edge == 0? q*res : edge == 1? q*res+res-1 : edge == 2? q : (res-1)*res+q;
+}
+
+static bool EdgesMatch(BezierPatch *a, int ea, BezierPatch *b, int eb, bool reversed, float eps) {
+	for (int m = 0; m < 4; m++)
+		if (length(EdgePoint(a, ea, m)-EdgePoint(b, eb, reversed? 3-m : m)) > eps)
+			return false;
+	return true;
+}
+
+static float MatchTolerance(BezierPatch **patches, int npatches) {
+	// control points of neighbours are set separately, so match within a tolerance
+	float size = 0;
+	for (int i = 0; i < npatches; i++)
+		for (int k = 0; k < 16; k++)
+			size = std::max(size, length(patches[i]->pts[k/4][k%4].point));
+	return 1e-5f*(1+size);
+}
+
+void FindSharedEdges(BezierPatch **patches, int npatches, vector<SharedEdge> &edges) {
+	float eps = MatchTolerance(patches, npatches);
+	edges.resize(0);
+	for (int i = 0; i < npatches; i++)
+		for (int e = 0; e < 4; e++) {
+			if (EdgesMatch(patches[i], e, patches[i], e, true, eps) &&
+				length(EdgePoint(patches[i], e, 0)-EdgePoint(patches[i], e, 1)) <= eps)
+				continue;	// collapsed to a point (as at the tip)
+			for (int j = i+1; j < npatches; j++)
+				for (int f = 0; f < 4; f++)
+					for (int r = 0; r < 2; r++)
+						if (EdgesMatch(patches[i], e, patches[j], f, r == 1, eps)) {
+							SharedEdge se = {i, e, j, f, r == 1};
+							edges.push_back(se);
+						}
+		}
+}
+
+struct Stitch {
+	int  src, srcEdge, srcRes;			// coarser side (or lower index)
+	int  dst, dstEdge;
+	bool reversed;
+};
+
+static bool StitchBefore(const Stitch &a, const Stitch &b) {
+	// sources set before they are read: coarsest first, then by index
+	return a.srcRes != b.srcRes? a.srcRes < b.srcRes : a.src < b.src;
+}
+
+void StitchEdges(BezierPatch **patches, vector<SharedEdge> &edges, vector<bool> &changed) {
+	vector<Stitch> stitches;
+	for (int i = 0; i < (int) edges.size(); i++) {
+		SharedEdge &e = edges[i];
+		if (!changed[e.patch] && !changed[e.other])
+			continue;
+		BezierPatch *pair[] = {patches[e.patch], patches[e.other]};
+		if (!EdgesMatch(pair[0], e.edge, pair[1], e.otherEdge, e.reversed, MatchTolerance(pair, 2)))
+			continue;	// boundary edited apart since FindSharedEdges
+		bool fromPatch = patches[e.patch]->res <= patches[e.other]->res;	// patch < other
+		Stitch s = {fromPatch? e.patch : e.other, fromPatch? e.edge : e.otherEdge, 0,
+					fromPatch? e.other : e.patch, fromPatch? e.otherEdge : e.edge, e.reversed};
+		s.srcRes = patches[s.src]->res;
+		stitches.push_back(s);
+	}
+	std::sort(stitches.begin(), stitches.end(), StitchBefore);
+	for (int i = 0; i < (int) stitches.size(); i++) {
+		Stitch &s = stitches[i];
+		BezierPatch *src = patches[s.src], *dst = patches[s.dst];
+		int rs = src->res, rd = dst->res;
+		if ((rd-1)%(rs-1))
+			continue;		// not nested: would need a transition strip
+		int ratio = (rd-1)/(rs-1);
+		for (int q = 0; q < rd; q++) {
+			int k = q/ratio, f = q%ratio;
+			vec3 v = src->vertices[EdgeVertex(rs, s.srcEdge, s.reversed? rs-1-k : k)];
+			if (f) {
+				vec3 v1 = src->vertices[EdgeVertex(rs, s.srcEdge, s.reversed? rs-2-k : k+1)];
+				v = v+((float) f/ratio)*(v1-v);
+			}
+			dst->vertices[EdgeVertex(rd, s.dstEdge, q)] = v;
+		}
+		dst->version++;
+	}
+}
+
+// Vertex Formats
+
+int VertexBytes(VertexFormat format) {
+	return format == VertexHalf? sizeof(HalfVertex) :
+		   format == VertexInterleaved? sizeof(InterleavedVertex) : 2*sizeof(vec3);
+}
+
+static float SignNotZero(float f) {
+	return f < 0? -1.f : 1.f;
+}
+
+void OctEncode(vec3 n, short oct[2]) {
+	// project onto the octahedron, fold the lower half over the upper
+	float l1 = fabs(n.x)+fabs(n.y)+fabs(n.z);
+	float x = l1 > 0? n.x/l1 : 0, y = l1 > 0? n.y/l1 : 0;
+	if (n.z < 0) {
+		float fx = (1-fabs(y))*SignNotZero(x), fy = (1-fabs(x))*SignNotZero(y);
+		x = fx;
+		y = fy;
+	}
+	oct[0] = (short) floor(32767*std::max(-1.f, std::min(1.f, x))+.5f);
+	oct[1] = (short) floor(32767*std::max(-1.f, std::min(1.f, y))+.5f);
+}
+
+vec3 OctDecode(short oct[2]) {
+	float x = oct[0]/32767.f, y = oct[1]/32767.f, z = 1-fabs(x)-fabs(y);
+	if (z < 0) {
+		float fx = (1-fabs(y))*SignNotZero(x), fy = (1-fabs(x))*SignNotZero(y);
+		x = fx;
+		y = fy;
+	}
+	return normalize(vec3(x, y, z));
+}
+
+unsigned short FloatToHalf(float f) {
+	unsigned int x;
+	memcpy(&x, &f, 4);
+	unsigned int sign = (x >> 16) & 0x8000, m = x & 0x7fffff;
+	int e = (int) ((x >> 23) & 0xff)-127+15;
+	if ((x & 0x7fffffff) > 0x7f800000)
+		return sign | 0x7e00;						// NaN
+	if (e >= 31)
+		return sign | 0x7c00;						// overflow to infinity
+	if (e <= 0) {
+		// denormal: value is (m | implicit 1) >> (14-e) units of 2^-24
+		if (e < -10)
+			return sign;
+		m |= 0x800000;
+		int shift = 14-e;
+		unsigned int h = m >> shift, rem = m & ((1 << shift)-1), half = 1 << (shift-1);
+		if (rem > half || (rem == half && (h & 1)))
+			h++;
+		return sign | h;
+	}
+	unsigned int h = (e << 10) | (m >> 13), rem = m & 0x1fff;
+	if (rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+		h++;										// a carry rounds up the exponent, correctly
+	return sign | h;
+}
+
+float HalfToFloat(unsigned short h) {
+	unsigned int sign = (h & 0x8000) << 16, e = (h >> 10) & 0x1f, m = h & 0x3ff, x;
+	if (e == 0) {
+		float f = ldexp((float) m, -24);
+		return sign? -f : f;
+	}
+	x = e == 31? sign | 0x7f800000 | (m << 13) : sign | ((e-15+127) << 23) | (m << 13);
+	float f;
+	memcpy(&f, &x, 4);
+	return f;
+}
+
+void VertexBox(vec3 *vertices, int n, vec3 &center, vec3 &scale) {
+	vec3 lo = n? vertices[0] : vec3(0, 0, 0), hi = lo;
+	for (int k = 1; k < n; k++)
+		for (int c = 0; c < 3; c++) {
+			lo[c] = std::min(lo[c], vertices[k][c]);
+			hi[c] = std::max(hi[c], vertices[k][c]);
+		}
+	center = .5f*(lo+hi);
+	scale = .5f*(hi-lo);
+	for (int c = 0; c < 3; c++)
+		if (!(scale[c] > 0))
+			scale[c] = 1;							// flat in c: any scale is exact
+}
+
+void PackVertices(VertexFormat format, vec3 *vertices, vec3 *normals, int n,
+				  vec3 center, vec3 scale, int box, void *dst) {
+	if (format == VertexInterleaved)
+		for (int k = 0; k < n; k++) {
+			InterleavedVertex &v = ((InterleavedVertex *) dst)[k];
+			v.position = vertices[k];
+			OctEncode(normals[k], v.normal);
+		}
+	if (format == VertexHalf) {
+		unsigned short w = FloatToHalf((float) box);
+		for (int k = 0; k < n; k++) {
+			HalfVertex &v = ((HalfVertex *) dst)[k];
+			for (int c = 0; c < 3; c++)
+				v.position[c] = FloatToHalf((vertices[k][c]-center[c])/scale[c]);
+			v.position[3] = w;
+			OctEncode(normals[k], v.normal);
+		}
+	}
+}
+
+void UnpackVertices(VertexFormat format, void *src, int n, vec3 center, vec3 scale,
+					vec3 *vertices, vec3 *normals) {
+	for (int k = 0; k < n; k++) {
+		if (format == VertexInterleaved) {
+			InterleavedVertex &v = ((InterleavedVertex *) src)[k];
+			vertices[k] = v.position;
+			normals[k] = OctDecode(v.normal);
+		}
+		if (format == VertexHalf) {
+			HalfVertex &v = ((HalfVertex *) src)[k];
+			for (int c = 0; c < 3; c++)
+				vertices[k][c] = center[c]+scale[c]*HalfToFloat(v.position[c]);
+			normals[k] = OctDecode(v.normal);
+		}
+	}
+}
+
+void VertexFormatReport(BezierPatch &p) {
+	int n = p.res*p.res;
+	vector<vec3> fv(n), fn(n), v(n), nrm(n);
+	p.Tessellate(&fv[0], &fn[0]);
+	vec3 center, scale;
+	VertexBox(&fv[0], n, center, scale);
+	float size = 2*length(scale);
+	const char *names[] = {"float", "interleaved", "half"};
+	printf("vertex formats vs float (res %i, box diagonal %g)\n", p.res, size);
+	printf("  format       bytes  pos err (rel)        normal err (deg)\n");
+	for (int f = VertexFloat; f <= VertexHalf; f++) {
+		VertexFormat format = (VertexFormat) f;
+		float posErr = 0, angErr = 0;
+		if (format != VertexFloat) {
+			vector<char> packed(n*VertexBytes(format));
+			PackVertices(format, &fv[0], &fn[0], n, center, scale, 0, &packed[0]);
+			UnpackVertices(format, &packed[0], n, center, scale, &v[0], &nrm[0]);
+			for (int k = 0; k < n; k++) {
+				float chord = length(nrm[k]-fn[k]);
+				posErr = std::max(posErr, length(v[k]-fv[k]));
+				if (chord == chord)
+					angErr = std::max(angErr, 2*std::asin(std::min(1.f, chord/2))/DegreesToRadians);
+			}
+		}
+		printf("  %-12s %-6i %-9.2e (%.1e)    %.2e\n",
+			names[f], VertexBytes(format), posErr, size > 0? posErr/size : 0, angErr);
+	}
+}
+
+void BezierPatch::SetControlSegments() {
+	int segs[][2] = {{0,1},{1,2},{2,3},{4,5},{5,6},{6,7},{8,9},{9,10},{10,11},{12,13},{13,14},{14,15},
+					 {0,4},{4,8},{8,12},{1,5},{5,9},{9,13},{2,6},{6,10},{10,14},{3,7},{7,11},{11,15}};
+	controlSegments.resize(24);
+	for (int i = 0; i < 24; i++)
+		controlSegments[i] = int2(segs[i][0], segs[i][1]);
+}
+
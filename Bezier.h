@@ -0,0 +1,212 @@
+// Bezier.h - GL-free bicubic Bezier patch: evaluation, tessellation, curvature correction
+
+#ifndef BEZIER_HDR
+#define BEZIER_HDR
+
+#include <vector>
+#include "mat.h"
+
+using std::vector;
+
+enum TriangleOrder {RowOrder, TipsifyOrder, ForsythOrder};
+	// RowOrder: two triangles per quad, row by row; the others reorder for post-transform
+	// vertex cache reuse (Sander et al., "Fast Triangle Reordering for Vertex Locality and
+	// Reduced Overdraw"; Forsyth, "Linear-Speed Vertex Cache Optimisation")
+
+struct Topology {
+	int          res;					// res*res vertices
+	TriangleOrder order;				// of triangles
+	vector<int3> triangles;				// 2(res-1)**2 triangles
+	vector<int>  strips;				// the triangles as one strip per row, separated by RestartIndex
+	vector<int2> segments;				// triangle outlines
+	enum {RestartIndex = -1};			// all ones when narrowed to the element type
+	void SetTriangles();
+	void SetStrips();
+	void SetSegments();
+};
+
+Topology *GetTopology(int res);
+	// triangles and segments for a res by res grid, built once and shared
+
+void SetTriangleOrder(TriangleOrder order);
+	// reorder the triangles of all topologies, and of those built later
+
+void OrderTriangles(TriangleOrder order, vector<int3> &triangles, int nVerts, int cacheSize = 16);
+	// reorder triangles (indexing nVerts vertices) in place; cacheSize is Tipsify's target
+
+float ACMR(int *indices, int nIndices, int cacheSize, bool strip = false);
+	// average cache miss ratio: vertex transforms per triangle with a FIFO post-transform
+	// cache of cacheSize entries; 0.5 is ideal for large grids, 3 the worst; if strip,
+	// indices form triangle strips separated by Topology::RestartIndex
+
+void ACMRReport(int maxRes = 320, int cacheSize = 16);
+	// print ACMR of each order and of strips, for res = 10, 20, 40, ... maxRes
+
+class BezierPatch {
+public:
+	enum SampleMode {UniformSamples, CurvatureSamples};
+		// CurvatureSamples spaces the grid in s and t so that each interval has an equal share of
+		// the chord error bound from the control net
+	struct patchPoints{
+		vec3 point;
+		vec3 origPoint;
+		float xresis;					// how resistant to being moved a point is in x-direction
+		float yresis;					// how resistant to being moved a point is in y-direction
+	};
+	patchPoints  pts[4][4];             // 16 control points, indexed by [s][t]
+	int          res;                   // res*res vertices
+	vector<vec3> vertices;				// res*res, set by Tessellate
+	vector<vec3> normals;				// res*res unit normals, set by Tessellate
+	Topology    *topology;				// shared by all patches of this res
+	vector<int2> controlSegments;		// control mesh
+	unsigned int dirtyPoints;			// bit 4*s+t set if pts[s][t] moved since last Tessellate
+	int          version;				// incremented whenever vertices, normals change
+	SampleMode   sampleMode;
+	vector<float> sSamples, tSamples;	// res parameters each, set by Tessellate if CurvatureSamples
+	enum {AllPoints = 0xffff};
+	BezierPatch();
+	void SetRes(int res);
+		// set topology and tessellate
+	void Init(int res, vec3 p0,  vec3 p1,  vec3 p2,  vec3 p3);
+		// create patch of 16 control points from quadrilateral
+	void Init(int res, vec3 p0,  vec3 p1,  vec3 p2,  vec3 p3,
+		               vec3 p4,  vec3 p5,  vec3 p6,  vec3 p7, 
+					   vec3 p8,  vec3 p9,  vec3 p10, vec3 p11,
+					   vec3 p12, vec3 p13, vec3 p14, vec3 p15);
+		// create patch given 16 control points
+	void Tessellate();
+		// set vertices, normals from the control points, each sample from cached Bernstein weights
+	void Tessellate(vec3 *vertices, vec3 *normals);
+		// compute res*res vertices and unit normals into the given arrays
+	void SetControlSegments();
+		// set controlSegments to the 24 segments of the control mesh, as pairs of 4*s+t
+	void SetSampleMode(SampleMode mode);
+		// marks dirty
+	float ChordError(int res);
+		// estimate (not a strict bound) of the distance between a res by res grid and the surface,
+		// for the sample mode and, if CurvatureSamples, the floor PlaceSamples applies
+	// dirty tracking
+	void SetPoint(int s, int t, vec3 p);
+		// move pts[s][t], marking it dirty if it changed
+	void MarkDirty(int s, int t);
+		// note that pts[s][t].point was changed directly
+	void MarkDirty();
+		// force re-tessellation
+	bool IsDirty();
+		// has any control point moved since last Tessellate?
+	// curvature correction
+	void Curve(float movex, float movey);
+		// move control points from their original positions by -movex*xresis in x, movey*yresis in y;
+		// points with zero resistance stay clean
+	void Reset();
+		// restore control points to their original positions
+	bool Curves();
+		// does any control point have non-zero resistance? if not, Curve, Blend and BlendPoints
+		// leave the patch as is, and callers may skip it
+	void SetBlend(float xscale, float yscale);
+		// precompute grids so that Blend(k) matches Curve(k*xscale, k*yscale) then Tessellate
+	void Blend(float k);
+		// set control points, vertices and normals for curve strength k by blending the
+		// precomputed grids, without Bezier evaluation; normals are exact, not interpolated
+	void BlendPoints(float k);
+		// set only the control points for curve strength k, for blending on the GPU
+	// support
+	int          blendRes;				// res of the blend grids, 0 if none
+	vec2         blendScale;			// xscale, yscale given SetBlend
+	float        blendK;				// most recent curve strength given Blend, BlendPoints
+	vector<vec3> blendBase, blendDelta;	// vertices for original points, and change per unit k
+	vector<vec3> blendCross[3];			// normal direction is blendCross[0]+k*blendCross[1]+k*k*blendCross[2]
+	void TessellateBasis(vec3 *vertices, vec3 *normals);
+	void PlaceSamples();
+		// set sSamples, tSamples for res and the control points
+	void SPts(float s, vec3 spts[]);
+	void TPts(float t, vec3 tpts[]);
+	// geometry
+	vec3 Point(float s, float t);
+	vec3 Normal(float s, float t);
+	void Eval(float s, float t, vec3 &point, vec3 &stan, vec3 &ttan, vec3 *normal = NULL);
+		// the tangent vectors are unit length
+	void EvalBatch(int n, const float *s, const float *t,
+				   vec3 *points, vec3 *sTans = NULL, vec3 *tTans = NULL, vec3 *normals = NULL);
+		// as Eval for n (s[k], t[k]) pairs, using SSE or AVX when compiled for it;
+		// outputs not wanted may be NULL
+};
+
+void TessellationReport(BezierPatch &p, int maxRes = 320);
+	// print time per tessellation and error of the cached-basis grid relative to BezierPatch::Eval,
+	// for res = 10, 20, 40, ... maxRes
+
+// Adaptive Resolution
+
+int ScreenRes(BezierPatch &p, mat4 &fullview, int width, int height, int currentRes = 0,
+			  float pixelsPerSegment = 8, float tolerance = .5f, int maxRes = 65);
+	// res of the form 2^k+1 so that, projected to a width by height window, grid segments
+	// span at most pixelsPerSegment and the grid departs from the surface by at most tolerance
+	// pixels (bounded from the control hull); lowering currentRes requires a 25% margin
+
+struct SharedEdge {
+	int  patch, edge;					// edge 0: pts[0][m], 1: pts[3][m], 2: pts[m][0], 3: pts[m][3]
+	int  other, otherEdge;				// the patch whose boundary control points match
+	bool reversed;						// the edges' m run in opposite directions
+};
+
+void FindSharedEdges(BezierPatch **patches, int npatches, vector<SharedEdge> &edges);
+	// each pair of matching, non-degenerate boundaries once
+
+void StitchEdges(BezierPatch **patches, vector<SharedEdge> &edges, vector<bool> &changed);
+	// for edges of changed patches, set the finer side's boundary vertices on the coarser side's
+	// (either side if of equal res, which also replaces vertices interpolated by an earlier,
+	// coarser neighbour); nested res (2^k+1) make this crack-free; edges whose boundary control
+	// points no longer match are left as tessellated; modified patches' versions are incremented
+
+void BudgetRes(BezierPatch **patches, int npatches, int vertexBudget, int *res, int maxRes = 65);
+	// res of the form 2^k+1 for each patch, raising the patch of largest ChordError while
+	// the total vertex count stays within vertexBudget; res 2 (4 vertices per patch) is the
+	// floor, returned for all patches if vertexBudget is less than 4*npatches
+
+void SamplingReport(BezierPatch &p, int maxRes = 65);
+	// print measured grid error of uniform and curvature samples (and ChordError estimates), for
+	// res = 5, 9, 17, ... maxRes, and the uniform res that matches the curvature samples' error
+
+// Vertex Formats
+
+enum VertexFormat {VertexFloat, VertexInterleaved, VertexHalf};
+	// VertexFloat: float position and normal in separate streams, 24 bytes per vertex
+	// VertexInterleaved: float position, octahedral normal, 16 bytes
+	// VertexHalf: half float position relative to the patch's box, octahedral normal, 12 bytes
+
+struct InterleavedVertex {
+	vec3           position;
+	short          normal[2];			// octahedral, snorm16
+};
+
+struct HalfVertex {
+	unsigned short position[4];			// x, y, z in [-1,1] across the box; w the box index
+	short          normal[2];
+};
+
+int VertexBytes(VertexFormat format);
+
+void OctEncode(vec3 n, short oct[2]);
+vec3 OctDecode(short oct[2]);
+	// unit normal to and from two 16 bit coordinates on the octahedron |x|+|y|+|z| = 1
+
+unsigned short FloatToHalf(float f);
+float HalfToFloat(unsigned short h);
+	// IEEE 754 binary16, rounding to nearest even
+
+void VertexBox(vec3 *vertices, int n, vec3 &center, vec3 &scale);
+	// bounding box as center and half extents (never zero)
+
+void PackVertices(VertexFormat format, vec3 *vertices, vec3 *normals, int n,
+				  vec3 center, vec3 scale, int box, void *dst);
+	// write n vertices of an interleaved format; for VertexHalf, positions are relative to
+	// the box (center, scale), whose index box is stored with each vertex
+void UnpackVertices(VertexFormat format, void *src, int n, vec3 center, vec3 scale,
+					vec3 *vertices, vec3 *normals);
+	// as the vertex shader decodes them
+
+void VertexFormatReport(BezierPatch &p);
+	// print bytes per vertex and worst position, normal error of each format against float
+
+#endif
@@ -1,8 +1,11 @@
+#include <vector>
 #include "glew.h"
 #include "freeglut.h"
 #include "Draw.h"
 #include "GLSL.h"
 
+using std::vector;
+
 
 //****** Errors
 
@@ -29,6 +32,20 @@ void  CheckGL_Errors()
 }
 
 
+//****** Profile
+
+bool CoreProfile()
+{
+	static int core = -1;
+	if (core < 0) {
+		GLint mask = 0;
+		glGetIntegerv(GL_CONTEXT_PROFILE_MASK, &mask);
+		core = (mask & GL_CONTEXT_CORE_PROFILE_BIT) != 0;
+	}
+	return core == 1;
+}
+
+
 //****** Screen Mode
 
 mat4 ScreenMode()
@@ -107,70 +124,242 @@ void ScreenLine(float xscreen, float yscreen, mat4 &modelview, mat4 &persp, floa
 }
 
 
+//***** Camera
+
+static GLuint cameraBuffer = 0;
+
+struct CameraBlock {
+	// std140 layout of uniform block Camera, matrices row_major as in mat4
+	mat4 modelview, persp, fullview, screen;
+	vec4 viewport;	// width, height in pixels
+};
+
+void SetCamera(mat4 &modelview, mat4 &persp)
+{
+	CameraBlock camera;
+	camera.modelview = modelview;
+	camera.persp = persp;
+	camera.fullview = persp*modelview;
+	camera.screen = ScreenMode();
+	camera.viewport = vec4((float) glutGet(GLUT_WINDOW_WIDTH), (float) glutGet(GLUT_WINDOW_HEIGHT), 0, 0);
+	if (!cameraBuffer) {
+		glGenBuffers(1, &cameraBuffer);
+		GLSL::BindBuffer(GL_UNIFORM_BUFFER, cameraBuffer);
+		glBindBufferBase(GL_UNIFORM_BUFFER, CAMERA_BINDING, cameraBuffer); // also binds target
+	}
+	GLSL::BindBuffer(GL_UNIFORM_BUFFER, cameraBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(CameraBlock), &camera, GL_STREAM_DRAW);
+}
+
+void BindCamera(int shader)
+{
+	GLuint index = glGetUniformBlockIndex(shader, "Camera");
+	if (index != GL_INVALID_INDEX)
+		glUniformBlockBinding(shader, index, CAMERA_BINDING);
+}
+
+
 //***** Draw Shader
 
 int drawShader = 0;
+GLSL::Uniform drawView, drawViewSource;
+int viewSource = -1;	// as last set in draw shader
 
 char *drawVShader = "\
 	#version 400								\n\
 	layout (location = 0) in vec3 position;		\n\
-	layout (location = 1) in vec3 color;		\n\
-	out vec3 vColor;							\n\
+	layout (location = 1) in vec4 color;		\n\
+	layout (location = 2) in float size;		\n\
+	layout (location = 3) in uint dash;			\n\
+	out vec4 vColor;							\n\
+	flat out uint vDash;						\n\
+	flat out vec2 vStart;						\n\
+	noperspective out vec2 vScreen;				\n\
+	layout (std140, row_major) uniform Camera {	\n\
+		mat4 modelview, persp, fullview, screen;\n\
+		vec4 viewport;							\n\
+	};											\n\
     uniform mat4 view; // persp*modelView       \n\
+	uniform int viewSource = 0;					\n\
 	void main()									\n\
 	{											\n\
-		gl_Position = view*vec4(position, 1);	\n\
+		// 0: view, 1: camera fullview, 2: screen\n\
+		mat4 m = viewSource == 1? fullview :	\n\
+				 viewSource == 2? screen : view;\n\
+		gl_Position = m*vec4(position, 1);		\n\
+		gl_PointSize = size;					\n\
 		vColor = color;							\n\
+		// pixel position; flat start is the	\n\
+		// segment's first (provoking) vertex	\n\
+		vec2 ndc = gl_Position.xy/gl_Position.w;\n\
+		vScreen = (.5*ndc+.5)*viewport.xy;		\n\
+		vStart = vScreen;						\n\
+		vDash = dash;							\n\
 	}											\n";
 
 char *drawFShader = "\
 	#version 400								\n\
-	uniform float opacity = 1;					\n\
-	in vec3 vColor;								\n\
+	in vec4 vColor;								\n\
+	flat in uint vDash; // pattern|factor<<16	\n\
+	flat in vec2 vStart;						\n\
+	noperspective in vec2 vScreen;				\n\
 	out vec4 fColor;							\n\
 	void main()									\n\
 	{											\n\
-	    fColor = vec4(vColor, opacity);			\n\
+		if (vDash != 0u) {						\n\
+			// as glLineStipple: bit n covers	\n\
+			// pixels [n*factor, (n+1)*factor)	\n\
+			float factor = float(vDash >> 16);	\n\
+			uint n = uint(distance(vScreen, vStart)/factor) % 16u;\n\
+			if ((vDash & (1u << n)) == 0u)		\n\
+				discard;						\n\
+		}										\n\
+	    fColor = vColor;						\n\
 	}											\n";
 
 void UseDrawShader()
 {
-	if (!drawShader)
+	if (!drawShader) {
 		drawShader = InitShader(drawVShader, drawFShader);
-	glUseProgram(drawShader);
-	glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glEnable(GL_LINE_SMOOTH);
-	glEnable(GL_POINT_SMOOTH);
+		drawView = GLSL::Uniform(drawShader, "view");
+		drawViewSource = GLSL::Uniform(drawShader, "viewSource");
+		BindCamera(drawShader);
+		glProvokingVertex(GL_FIRST_VERTEX_CONVENTION); // dashes measured from segment start
+	}
+	GLSL::UseProgram(drawShader);
+	GLSL::Enable(GL_BLEND);
+    GLSL::BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    GLSL::Enable(GL_LINE_SMOOTH);
+	if (!CoreProfile())
+		GLSL::Enable(GL_POINT_SMOOTH);
+	GLSL::Enable(GL_PROGRAM_POINT_SIZE);
+}
+
+static void SetViewSource(int source)
+{
+	if (source != viewSource)
+		drawViewSource.Set(viewSource = source);
 }
 
 void UseDrawShader(mat4 viewMatrix)
 {
+	FlushDraw();
 	UseDrawShader();
-	GLSL::SetUniform(drawShader, "view", viewMatrix);
+	SetViewSource(0);
+	drawView.Set(viewMatrix);
 }
 
-class DrawBuffer {
-public:
-	DrawBuffer() {
-		vBuf = -1;
-	}
-	~DrawBuffer() {
-		// if (vBuf > 0)
-		//  	glDeleteBuffers(1, &vBuf);
+void UseDrawShader(CameraView view)
+{
+	FlushDraw();
+	UseDrawShader();
+	SetViewSource(view == FullView? 1 : 2);
+}
+
+
+
+//***** Batching
+
+struct DrawVertex {
+	vec3  position;
+	vec4  color;	// rgb, opacity
+	float size;		// point diameter, in pixels
+	GLuint dash;	// stipple pattern | factor << 16, or 0 if solid
+};
+
+static vector<DrawVertex> fillVertices, lineVertices, pointVertices;
+static GLuint streamBuffer = 0, streamArray = 0;
+static int    streamCapacity = 0;	// in vertices
+static int    batchDepth = 0;		// > 0 between BeginDraw and EndDraw
+static GLuint stipple = DashCode();	// as set by Stipple
+static bool   dashing = false;		// between DashOn and DashOff
+
+static void Append(vector<DrawVertex> &v, float *p, float *col, float opacity, float size = 1, GLuint dash = 0)
+{
+	DrawVertex d;
+	d.position = vec3(p[0], p[1], p[2]);
+	d.color = vec4(col[0], col[1], col[2], opacity);
+	d.size = size;
+	d.dash = dash;
+	v.push_back(d);
+}
+
+static void Recorded()
+{
+	// outside a batch, draw immediately
+	if (!batchDepth)
+		FlushDraw();
+}
+
+void BeginDraw()
+{
+	batchDepth++;
+}
+
+void EndDraw()
+{
+	if (batchDepth > 0 && --batchDepth == 0)
+		FlushDraw();
+}
+
+void FlushDraw()
+{
+	int nFills = fillVertices.size(), nLines = lineVertices.size(), nPoints = pointVertices.size();
+	int nVertices = nFills+nLines+nPoints;
+	if (!nVertices)
+		return;
+	int program = GLSL::CurrentShader();
+	if (program != drawShader)
+		UseDrawShader();
+	if (!streamBuffer) {
+		// connect shader inputs (layout locations 0-3), once
+		int stride = sizeof(DrawVertex);
+		glGenBuffers(1, &streamBuffer);
+		glGenVertexArrays(1, &streamArray);
+		GLSL::BindVertexArray(streamArray);
+		GLSL::BindBuffer(GL_ARRAY_BUFFER, streamBuffer);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void *) 0);
+		glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, stride, (void *) sizeof(vec3));
+		glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, stride, (void *) (sizeof(vec3)+sizeof(vec4)));
+		glVertexAttribIPointer(3, 1, GL_UNSIGNED_INT, stride, (void *) (sizeof(vec3)+sizeof(vec4)+sizeof(float)));
+		for (int i = 0; i < 4; i++)
+			glEnableVertexAttribArray(i);
 	}
-	GLuint vBuf;
-} dotBuffer, lineBuffer, quadBuffer;
+	// copy to streaming buffer, grown as needed and orphaned each flush
+	GLSL::BindVertexArray(streamArray);
+	GLSL::BindBuffer(GL_ARRAY_BUFFER, streamBuffer);
+	if (nVertices > streamCapacity)
+		streamCapacity = nVertices > 2*streamCapacity? nVertices : 2*streamCapacity;
+	glBufferData(GL_ARRAY_BUFFER, streamCapacity*sizeof(DrawVertex), NULL, GL_STREAM_DRAW);
+	vector<DrawVertex> *lists[] = {&fillVertices, &lineVertices, &pointVertices};
+	for (int i = 0, offset = 0; i < 3; offset += lists[i++]->size())
+		if (lists[i]->size())
+			glBufferSubData(GL_ARRAY_BUFFER, offset*sizeof(DrawVertex), lists[i]->size()*sizeof(DrawVertex), &(*lists[i])[0]);
+	// one draw per primitive type: fills, then outlines, then dots
+	if (nFills)
+		glDrawArrays(GL_TRIANGLES, 0, nFills);
+	if (nLines)
+		glDrawArrays(GL_LINES, nFills, nLines);
+	if (nPoints)
+		glDrawArrays(GL_POINTS, nFills+nLines, nPoints);
+	fillVertices.resize(0);
+	lineVertices.resize(0);
+	pointVertices.resize(0);
+	GLSL::BindVertexArray(0);
+	GLSL::BindBuffer(GL_ARRAY_BUFFER, 0);
+	if (program != drawShader)
+		GLSL::UseProgram(program);
+}
 
 
 //***** Display
 
 // Lines
 
-void Stipple(int factor, int a,int b,int c,int d,int e,int f,int g,int h,
-                         int i,int j,int k,int l,int m,int n,int o,int p)
+static GLuint StippleCode(int factor, int a,int b,int c,int d,int e,int f,int g,int h,
+                                      int i,int j,int k,int l,int m,int n,int o,int p)
 {
-    GLushort pattern = 0;
+    GLuint pattern = 0;
     int bits[16] = {a,b,c,d,e,f,g,h,i,j,k,l,m,n,o,p};
     for (int index = 0; index < 16; index++) {
         int bit = bits[index];
@@ -178,60 +367,40 @@ void Stipple(int factor, int a,int b,int c,int d,int e,int f,int g,int h,
             break;
         pattern |= 1<<bit;
     }
-    glLineStipple(factor, pattern);
+	factor = factor < 1? 1 : factor > 256? 256 : factor;	// range of glLineStipple
+    return pattern | factor << 16;
+}
+
+void Stipple(int factor, int a,int b,int c,int d,int e,int f,int g,int h,
+                         int i,int j,int k,int l,int m,int n,int o,int p)
+{
+	stipple = StippleCode(factor, a, b, c, d, e, f, g, h, i, j, k, l, m, n, o, p);
+	dashing = true;
+}
+
+GLuint DashCode(int factor, int off)
+{
+	return StippleCode(factor, (0+off)%16, (1+off)%16, (2+off)%16, (3+off)%16, (8+off)%16, (9+off)%16, (10+off)%16, (11+off)%16,
+					   -1, -1, -1, -1, -1, -1, -1, -1);
 }
 
 void DashOn(int factor, int off)
 {
-	glEnable(GL_LINE_STIPPLE);
-	Stipple(factor, (0+off)%16, (1+off)%16, (2+off)%16, (3+off)%16, (8+off)%16, (9+off)%16, (10+off)%16, (11+off)%16);
+	stipple = DashCode(factor, off);
+	dashing = true;
 }
 
 void DashOff()
 {
-	glDisable(GL_LINE_STIPPLE);
+	dashing = false;
 }
 
 void Line(float *p1, float *p2, float *col1, float *col2, float opacity)
 {
-	bool alreadyUsing = GLSL::CurrentShader() == drawShader;
-	if (!alreadyUsing)
-		UseDrawShader();
-
-	// align vertex data
-	float points[][3] = {{p1[0], p1[1], p1[2]}, {p2[0], p2[1], p2[2]}};
-	float colors[][3]  = {{col1[0], col1[1], col1[2]}, {col2[0], col2[1], col2[2]}};
-
- 	// create a vertex buffer for the array
-	if (quadBuffer.vBuf < 0) {
-		glGenBuffers(1, &quadBuffer.vBuf);
-		glBindBuffer(GL_ARRAY_BUFFER, quadBuffer.vBuf);
-		// allocate buffer memory and load location and color data
-		int bufferSize = sizeof(points)+sizeof(colors);
-		glBufferData(GL_ARRAY_BUFFER, bufferSize, NULL, GL_STATIC_DRAW);
-	}
-
-    // set active vertex buffer
-    glBindBuffer(GL_ARRAY_BUFFER, lineBuffer.vBuf);
-
-    // allocate buffer memory and load location and color data
-	glBufferData(GL_ARRAY_BUFFER, sizeof(points)+sizeof(colors), NULL, GL_STATIC_DRAW);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(points), points);
-    glBufferSubData(GL_ARRAY_BUFFER, sizeof(points), sizeof(colors), colors);
-
-    // connect shader inputs
-	GLSL::VertexAttribPointer(drawShader, "position", 3, GL_FLOAT, GL_FALSE, 0, (void *) 0);
-    GLSL::VertexAttribPointer(drawShader, "color", 3, GL_FLOAT, GL_FALSE, 0, (void *) sizeof(points));
-
-	GLSL::SetUniform(drawShader, "opacity", opacity);
-
-	// draw
-	glDrawArrays(GL_LINES, 0, 2);
-
-	// cleanup
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	if (!alreadyUsing)
-		glUseProgram(0);
+	GLuint dash = dashing? stipple : 0;
+	Append(lineVertices, p1, col1, opacity, 1, dash);
+	Append(lineVertices, p2, col2, opacity, 1, dash);
+	Recorded();
 }
 
 void Line(vec2 &p1, vec2 &p2, vec3 &col1, vec3 &col2, float opacity)
@@ -242,7 +411,8 @@ void Line(vec2 &p1, vec2 &p2, vec3 &col1, vec3 &col2, float opacity)
 
 void Line(vec3 &p1, vec3 &p2, vec3 &col, float opacity, float width)
 {
-	glLineWidth(width);
+	FlushDraw();	// width applies to subsequent lines only
+	glLineWidth(CoreProfile()? 1.f : width);	// no wide lines in a core profile
 	Line(p1, p2, col, col, opacity);
 }
 
@@ -269,34 +439,8 @@ void Line(int x1, int y1, int x2, int y2, float *col1, float *col2, float opacit
 
 void Disk(float *point, float radius, float *color)
 {
-	UseDrawShader();
-
-	// create a vertex buffer
-	if (dotBuffer.vBuf < 0) {
-		glGenBuffers(1, &dotBuffer.vBuf);
-		glBindBuffer(GL_ARRAY_BUFFER, dotBuffer.vBuf);
-		int bufferSize = 6*sizeof(float);
-		glBufferData(GL_ARRAY_BUFFER, bufferSize, NULL, GL_STATIC_DRAW);
-	}
-
-	// set active buffer
-	glBindBuffer(GL_ARRAY_BUFFER, dotBuffer.vBuf);
-
-    // allocate buffer memory and load location and color data
-	glBufferData(GL_ARRAY_BUFFER, 6*sizeof(float), NULL, GL_STATIC_DRAW);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, 3*sizeof(float), point);
-	glBufferSubData(GL_ARRAY_BUFFER, 3*sizeof(float), 3*sizeof(float), color);
-
-	// connect shader inputs
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void *) 0);				// position
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void *) sizeof(vec3));	// color
-	// if not using layouts:
-		//GLSL::VertexAttribPointer(drawShader.id, "position", 3, GL_FLOAT, GL_FALSE, 0, (void *) 0);
-		//GLSL::VertexAttribPointer(drawShader.id, "color", 3, GL_FLOAT, GL_FALSE, 0, (void *) sizeof(vec3));
-
-	// draw, cleanup
-	glPointSize(radius);
-	glDrawArrays(GL_POINTS, 0, 1);
+	Append(pointVertices, point, color, 1, radius);
+	Recorded();
 }
 
 void Disk(vec3 &p, float radius, vec3 &color)
@@ -329,7 +473,8 @@ void Arrow(vec2 &base, vec2 &head, char *label, double headSize, vec3 &col)
         Line(head, head2, col, col);
     }
     if (label) {
-		glColor3fv(&col.x);
+		if (!CoreProfile())
+			glColor3fv(&col.x);
         Text((int)head.x+5, (int)head.y, label);
 	}
 }
@@ -348,36 +493,11 @@ void ArrowV(vec3 &base, vec3 &vec, mat4 &m, char *label, double headSize, vec3 &
 
 void Quad(vec3 &p1, vec3 &p2, vec3 &p3, vec3 &p4, float *col, float opacity)
 {
-	UseDrawShader();
-
-	// align vertex data
-	float points[][3] = {p1.x, p1.y, p1.z, p2.x, p2.y, p2.z, p3.x, p3.y, p3.z, p4.x, p4.y, p4.z};
-	float colors[][3] = {col[0], col[1], col[2], col[0], col[1], col[2], col[0], col[1], col[2], col[0], col[1], col[2]};
-
- 	// create vertex buffer
-	if (lineBuffer.vBuf < 0) {
-		glGenBuffers(1, &quadBuffer.vBuf);
-		glBindBuffer(GL_ARRAY_BUFFER, quadBuffer.vBuf);
-		int bufferSize = sizeof(points)+sizeof(colors);
-		glBufferData(GL_ARRAY_BUFFER, bufferSize, NULL, GL_STATIC_DRAW);
-	}
-    glBindBuffer(GL_ARRAY_BUFFER, quadBuffer.vBuf);
-
-    // allocate buffer memory and load location and color data
-	glBufferData(GL_ARRAY_BUFFER, sizeof(points)+sizeof(colors), NULL, GL_STATIC_DRAW);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(points), points);
-    glBufferSubData(GL_ARRAY_BUFFER, sizeof(points), sizeof(colors), colors);
-
-    // connect shader inputs
-	GLSL::VertexAttribPointer(drawShader, "position", 3, GL_FLOAT, GL_FALSE, 0, (void *) 0);
-    GLSL::VertexAttribPointer(drawShader, "color", 3, GL_FLOAT, GL_FALSE, 0, (void *) sizeof(points));
-	GLSL::SetUniform(drawShader, "opacity", opacity);
-
-	// draw, cleanup
-	glDrawArrays(GL_QUADS, 0, 4);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-	glUseProgram(0);
+	// as two triangles (no GL_QUADS in a core profile)
+	vec3 *p[] = {&p1, &p2, &p3, &p1, &p3, &p4};
+	for (int i = 0; i < 6; i++)
+		Append(fillVertices, (float *) p[i], col, opacity);
+	Recorded();
 }
 
 #define N_CIRCLE_POINTS 12
@@ -399,18 +519,22 @@ static bool circleSet = SetCircle();
 
 void Text(int x, int y, const char *text)
 {
+	FlushDraw();	// keep text above previously drawn geometry
+	if (CoreProfile())
+		return;		// no raster text in a core profile
 	int program = GLSL::CurrentShader();
 	int w = glutGet(GLUT_WINDOW_WIDTH), h = glutGet(GLUT_WINDOW_HEIGHT);
-	glUseProgram(0); // no text support in GLSL
+	GLSL::UseProgram(0); // no text support in GLSL
 	glRasterPos2f((float) (2*x)/w-1, (float) (2*y)/h-1);
 	glutBitmapString(GLUT_BITMAP_9_BY_15, (unsigned char*) text);
-	glUseProgram(program);
+	GLSL::UseProgram(program);
 }
 
 void Text(vec3 &p, mat4 &m, char *text, vec3 &col)
 {
 	vec2 p2 = ScreenPoint(p, m);
-	glColor3fv(&col.x);
+	if (!CoreProfile())
+		glColor3fv(&col.x);
 	Text((int)p2.x+5, (int)p2.y, text);
 }
 
@@ -35,6 +35,12 @@ void CheckGL_Errors();
 	// print list of errors
 
 
+//****** Profile
+
+bool CoreProfile();
+	// is the current context a core profile? (no raster text, GL_QUADS, wide lines)
+
+
 //****** Screen Operations
 
 mat4 ScreenMode(int width, int height);
@@ -57,16 +63,44 @@ float ScreenDistSq(int x, int y, vec3 p, mat4 m, int width, int height, float *z
 	// point p transformed by view matrix m
 
 
+//****** Camera
+
+#define CAMERA_BINDING 0
+
+void SetCamera(mat4 &modelview, mat4 &persp);
+	// once per frame, set uniform block Camera {modelview, persp, fullview, screen}
+	// (std140, row_major), shared by all shaders that call BindCamera
+
+void BindCamera(int shader);
+	// connect shader's Camera block, if any, to the per-frame buffer
+
+
 //****** Drawing Functions
 
+enum CameraView {FullView, ScreenView};
+
 void UseDrawShader();
 
 void UseDrawShader(mat4 viewMatrix);
 	// invoke a shader specifically designed for the 3D draw routines
 
-// dash
+void UseDrawShader(CameraView view);
+	// as above, view from the Camera block (persp*modelview, or pixel space)
+
+// batching
+void BeginDraw();
+void EndDraw();
+	// between BeginDraw and EndDraw, lines, disks and quads are recorded and drawn
+	// with one call per primitive type when EndDraw, a view change, or Text flushes
+	// (outside a batch, each is drawn immediately); do not change GL state within a batch
+void FlushDraw();
+	// draw recorded primitives now
+
+// dash (in the draw shader; lines recorded between DashOn and DashOff are dashed)
 void DashOn(int factor = 1, int offset = 0);
 void DashOff();
+GLuint DashCode(int factor = 1, int offset = 0);
+	// DashOn's pattern | factor << 16, as read by the draw shader's dash attribute (location 3)
 
 // 3D line drawing
 void Line(vec3 &p1, vec3 &p2, vec3 &col, float opacity = 1, float width = 1);
@@ -105,5 +139,6 @@ void Stipple(int factor=1,int a=-1,int b=-1,int c=-1,int d=-1,int e=-1,
                           int f=-1,int g=-1,int h=-1,int i=-1,int j=-1,
                           int k=-1,int l=-1,int m=-1,int n=-1,int o=-1,int p=-1);
     // args a-p are bit positions; eg, glmStipple(1, 4) means turn on bit 4, others off
+	// dash subsequent lines with this pattern, until DashOff
 
 #endif
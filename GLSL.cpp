@@ -5,6 +5,8 @@
     ===========================================
 */
 
+#include <map>
+#include <string>
 #include "GLSL.h"
 
 //****** Support
@@ -214,11 +216,203 @@ int GLSL::LinkProgram(int vshader, int fshader, int gshader)
     return programID;
 }
 
+
+//****** Call Counts
+
+int GLSL::nLookups = 0, GLSL::nUniformSets = 0, GLSL::nFiltered = 0;
+
+void GLSL::ResetCounts()
+{
+	nLookups = nUniformSets = nFiltered = 0;
+}
+
+
+//****** State Cache
+
+static GLint currentProgram = -1, currentArray = -1;	// -1: unknown
+static std::map<GLenum, GLuint> buffers;				// binding per target
+static std::map<GLenum, bool> enabled;					// per capability
+static std::map<GLenum, GLenum> hints;
+static GLenum blendSrc = 0, blendDst = 0;				// 0: unknown
+
+void GLSL::InvalidateState()
+{
+	currentProgram = currentArray = -1;
+	buffers.clear();
+	enabled.clear();
+	hints.clear();
+	blendSrc = blendDst = 0;
+}
+
+void GLSL::UseProgram(GLuint program)
+{
+	if (currentProgram == (GLint) program) {
+		nFiltered++;
+		return;
+	}
+	glUseProgram(program);
+	currentProgram = program;
+}
+
 int GLSL::CurrentShader()
 {
-	int shader = 0;
-	glGetIntegerv(GL_CURRENT_PROGRAM, &shader);
-	return shader;
+	// as shadowed by the state cache, else queried
+	if (currentProgram < 0)
+		glGetIntegerv(GL_CURRENT_PROGRAM, &currentProgram);
+	return currentProgram;
+}
+
+void GLSL::BindVertexArray(GLuint array)
+{
+	if (currentArray == (GLint) array) {
+		nFiltered++;
+		return;
+	}
+	glBindVertexArray(array);
+	currentArray = array;
+}
+
+void GLSL::BindBuffer(GLenum target, GLuint buffer)
+{
+	std::map<GLenum, GLuint>::iterator i = buffers.find(target);
+	if (i != buffers.end() && i->second == buffer) {
+		nFiltered++;
+		return;
+	}
+	glBindBuffer(target, buffer);
+	buffers[target] = buffer;
+}
+
+void GLSL::DeleteBuffers(GLsizei n, GLuint *ids)
+{
+	// GL unbinds deleted buffers, and may reuse their names
+	for (std::map<GLenum, GLuint>::iterator i = buffers.begin(); i != buffers.end(); i++)
+		for (int k = 0; k < n; k++)
+			if (i->second == ids[k])
+				i->second = 0;
+	glDeleteBuffers(n, ids);
+}
+
+static void SetCapability(GLenum cap, bool on)
+{
+	std::map<GLenum, bool>::iterator i = enabled.find(cap);
+	if (i != enabled.end() && i->second == on) {
+		GLSL::nFiltered++;
+		return;
+	}
+	if (on)
+		glEnable(cap);
+	else
+		glDisable(cap);
+	enabled[cap] = on;
+}
+
+void GLSL::Enable(GLenum cap)
+{
+	SetCapability(cap, true);
+}
+
+void GLSL::Disable(GLenum cap)
+{
+	SetCapability(cap, false);
+}
+
+void GLSL::BlendFunc(GLenum src, GLenum dst)
+{
+	if (src == blendSrc && dst == blendDst) {
+		nFiltered++;
+		return;
+	}
+	glBlendFunc(src, dst);
+	blendSrc = src;
+	blendDst = dst;
+}
+
+void GLSL::Hint(GLenum target, GLenum mode)
+{
+	std::map<GLenum, GLenum>::iterator i = hints.find(target);
+	if (i != hints.end() && i->second == mode) {
+		nFiltered++;
+		return;
+	}
+	glHint(target, mode);
+	hints[target] = mode;
+}
+
+
+//****** Location Lookup
+
+typedef std::map<std::string, GLint> LocationTable;
+
+static std::map<int, LocationTable> uniformTables, attribTables; // indexed by program
+
+GLint GLSL::UniformLocation(int shader, const char *name)
+{
+	LocationTable &table = uniformTables[shader];
+	LocationTable::iterator i = table.find(name);
+	if (i != table.end())
+		return i->second;
+	nLookups++;
+	return table[name] = glGetUniformLocation(shader, name);
+}
+
+GLint GLSL::AttribLocation(int shader, const char *name)
+{
+	LocationTable &table = attribTables[shader];
+	LocationTable::iterator i = table.find(name);
+	if (i != table.end())
+		return i->second;
+	nLookups++;
+	return table[name] = glGetAttribLocation(shader, name);
+}
+
+
+//****** Uniform Handles
+
+bool GLSL::Uniform::Set(int val)
+{
+	if (id < 0)
+		return false;
+	nUniformSets++;
+	glUniform1i(id, val);
+	return true;
+}
+
+bool GLSL::Uniform::Set(float val)
+{
+	if (id < 0)
+		return false;
+	nUniformSets++;
+	glUniform1f(id, val);
+	return true;
+}
+
+bool GLSL::Uniform::Set(vec3 &v)
+{
+	if (id < 0)
+		return false;
+	nUniformSets++;
+	glUniform3f(id, v.x, v.y, v.z);
+	return true;
+}
+
+bool GLSL::Uniform::Set(int count, vec3 *v)
+{
+	// elements 0 to count-1 of an array
+	if (id < 0)
+		return false;
+	nUniformSets++;
+	glUniform3fv(id, count, (float *) v);
+	return true;
+}
+
+bool GLSL::Uniform::Set(mat4 &m)
+{
+	if (id < 0)
+		return false;
+	nUniformSets++;
+	glUniformMatrix4fv(id, 1, true, (float *) &m[0][0]);
+	return true;
 }
 
 
@@ -226,81 +420,90 @@ int GLSL::CurrentShader()
 
 bool GLSL::SetUniform(int shader, const char *name, int val)
 {
-	GLint id = glGetUniformLocation(shader, name);
+	GLint id = UniformLocation(shader, name);
 	if (id < 0)
 		return false;
+	nUniformSets++;
 	glUniform1i(id, val);
 	return true;
 }
 
 bool GLSL::SetUniformv(int shader, const char *name, int count, int *v)
 {
-	GLint id = glGetUniformLocation(shader, name);
+	GLint id = UniformLocation(shader, name);
 	if (id < 0)
 		return false;
+	nUniformSets++;
 	glUniform1iv(id, count, v);
 	return true;
 }
 
 bool GLSL::SetUniform(int shader, const char *name, float val)
 {
-	GLint id = glGetUniformLocation(shader, name);
+	GLint id = UniformLocation(shader, name);
 	if (id < 0)
 		return false;
+	nUniformSets++;
 	glUniform1f(id, val);
 	return true;
 }
 
 bool GLSL::SetUniform(int shader, const char *name, vec3 v)
 {
-	GLint id = glGetUniformLocation(shader, name);
+	GLint id = UniformLocation(shader, name);
 	if (id < 0)
 		return false;
+	nUniformSets++;
 	glUniform3f(id, v.x, v.y, v.z);
 	return true;
 }
 
 bool GLSL::SetUniform(int shader, const char *name, vec3 *v)
 {
-	GLint id = glGetUniformLocation(shader, name);
+	GLint id = UniformLocation(shader, name);
 	if (id < 0)
 		return false;
+	nUniformSets++;
 	glUniform3fv(id, 1, (float *) v);
 	return true;
 }
 
 bool GLSL::SetUniform(int shader, const char *name, vec4 *v)
 {
-	GLint id = glGetUniformLocation(shader, name);
+	GLint id = UniformLocation(shader, name);
 	if (id < 0)
 		return false;
+	nUniformSets++;
 	glUniform4fv(id, 1, (float *) v);
 	return true;
 }
 
 bool GLSL::SetUniform3(int shader, const char *name, float *v)
 {
-	GLint id = glGetUniformLocation(shader, name);
+	GLint id = UniformLocation(shader, name);
 	if (id < 0)
 		return false;
+	nUniformSets++;
 	glUniform3fv(id, 1, v);
 	return true;
 }
 
 bool GLSL::SetUniform3v(int shader, const char *name, int count, float *v)
 {
-	GLint id = glGetUniformLocation(shader, name);
+	GLint id = UniformLocation(shader, name);
 	if (id < 0)
 		return false;
+	nUniformSets++;
 	glUniform3fv(id, count, v);
 	return true;
 }
 
 bool GLSL::SetUniform(int shader, const char *name, mat4 m)
 {
-	GLint id = glGetUniformLocation(shader, name);
+	GLint id = UniformLocation(shader, name);
 	if (id < 0)
 		return false;
+	nUniformSets++;
 	glUniformMatrix4fv(id, 1, true, (float *) &m[0][0]);
 	return true;
 }
@@ -310,14 +513,14 @@ bool GLSL::SetUniform(int shader, const char *name, mat4 m)
 
 void GLSL::DisableVertexAttribute(int shader, const char *name)
 {
-	GLint id = glGetAttribLocation(shader, name);
+	GLint id = AttribLocation(shader, name);
 	if (id >= 0)
 		glDisableVertexAttribArray(id);
 }
 
 int GLSL::EnableVertexAttribute(int shader, const char *name)
 {
-	GLint id = glGetAttribLocation(shader, name);
+	GLint id = AttribLocation(shader, name);
 	if (id >= 0)
 		glEnableVertexAttribArray(id);
 	return id;
@@ -33,6 +33,43 @@ int LinkProgramViaCode(const char *vertexShaderCode, const char *fragmentShaderC
 int LinkProgram(int vshader, int fshader, int gshader = -1);
 int CurrentShader();
 
+// Call Counts
+extern int nLookups;		// glGetUniformLocation, glGetAttribLocation calls
+extern int nUniformSets;	// glUniform* calls
+extern int nFiltered;		// state calls skipped by the state cache
+void ResetCounts();
+
+// State Cache (shadows GL state set through these calls, skipping those that change nothing;
+// state set by direct GL calls elsewhere must be set through here, or InvalidateState called)
+void UseProgram(GLuint program);
+void BindVertexArray(GLuint array);
+void BindBuffer(GLenum target, GLuint buffer);
+	// not for GL_ELEMENT_ARRAY_BUFFER, which is vertex array state
+void DeleteBuffers(GLsizei n, GLuint *buffers);
+	// delete, unbinding any shadowed bindings of them
+void Enable(GLenum cap);
+void Disable(GLenum cap);
+void BlendFunc(GLenum src, GLenum dst);
+void Hint(GLenum target, GLenum mode);
+void InvalidateState();
+
+// Location Lookup (cached per program and name; GL queried on first use only)
+GLint UniformLocation(int shader, const char *name);
+GLint AttribLocation(int shader, const char *name);
+
+// Uniform Handles (location bound once, so setting involves no string lookup)
+class Uniform {
+public:
+	GLint id;
+	Uniform() : id(-1) { }
+	Uniform(int shader, const char *name) : id(UniformLocation(shader, name)) { }
+	bool Set(int val);
+	bool Set(float val);
+	bool Set(vec3 &v);
+	bool Set(int count, vec3 *v);
+	bool Set(mat4 &m);
+};
+
 // Uniform Access
 bool SetUniform(int shader, const char *name, int val);
 bool SetUniformv(int shader, const char *name, int count, int *v);
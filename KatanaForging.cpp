@@ -2,10 +2,13 @@
 // Copyright (c) Joe Bjork, 2014
 // All rights reserved
 
+#include <string.h>
 #include "glew.h"
 #include "freeglut.h"
 #include "Draw.h"
+#include "GLSL.h"
 #include "Patch.h"
+#include "Schedule.h"
 #include "Widget.h"
 #include "mat.h"
 
@@ -14,6 +17,11 @@
 // display
 mat4		modelview, persp, fullview;
 bool    	viewControlMesh = true, viewShadedPatch = true, viewLinedPatch = false, viewCurve = false;
+bool		threaded = true;					// tessellate on thread pool
+bool		gpuCurve = false;					// curve strength applied in vertex shader
+TriangleOrder triangleOrder = RowOrder;		// of element buffers
+bool		adaptiveRes = false;				// per-patch res from projected size, else res
+bool		curvatureSampling = false;			// samples spaced by curvature, res budgeted unless adaptive
 float		blk[] = {0, 0, 0}, wht[] = {1, 1, 1};
 
 // widgets
@@ -21,6 +29,8 @@ Button		viewControlMeshBut(30, 20, 18, wht);
 Button		viewShadedPatchBut(30, 45, 18, wht);
 Button		viewLinedPatchBut(30, 70, 18, wht);
 Button		viewCurveBut(30, 95, 18, wht);
+Button		threadedBut(30, 120, 18, wht);
+Button		gpuCurveBut(30, 145, 18, wht);
 Slider		patchRes(200, 20, 62, 2, 40, 10, Slider::Horizontal, wht);
 Slider		curveyness(500, 20, 62, .01f, .3, .05f, Slider::Vertical, wht, true);
 Mover		ptMover;
@@ -31,49 +41,127 @@ const int		npatches = 12;
 const int		nTpatches = 6;						// subset of npatches for the ones that are triangular
 float			s = 2.f;							// scale from base points
 Patch			patches[npatches];
+Blade			blade;								// patches in one vertex buffer, drawn with multi-draw
+BezierPatch		*patchPtrs[npatches];				// for TessellatePatches
+vector<SharedEdge> sharedEdges;						// patch boundaries, stitched after tessellation
+
+// tessellation
+ThreadPool		*pool = NULL;
+double			tessTime = 0, uploadTime = 0;		// seconds, for most recent UpdatePatches
+int				nUpdated = 0;						// patches re-tessellated by most recent UpdatePatches
+bool			curveChanged = false;				// curve strength changed since last UpdatePatches
+bool			budgetChanged = false;				// budgeted res to be recomputed by next UpdatePatches
 
 // interaction
 int			xMouseDown, yMouseDown; // for each mouse down, need start point
 vec2		rotOld, rotNew;			// previous, current rotations
 mat4		rotM;				    // MouseDrag sets, Display uses
 bool		cameraDown = false;
+int			pickedPatch, pickedPoint;	// PickPoint sets: patches[pickedPatch].pts[pickedPoint/4][pickedPoint%4]
 
-// Curvature Correction
-void CC(){
-	float movex = curveyness.GetValue()* s, movey = 2*curveyness.GetValue()*s;
-	for (int i = 0; i < npatches; i++){
-		for (int j = 0; j < 16; j++){
-			vec3 temp = patches[i].pts[j / 4][j % 4].origPoint;
-			float xResist = patches[i].pts[j / 4][j % 4].xresis;
-			float yResist = patches[i].pts[j / 4][j % 4].yresis;
-			temp = vec3(temp.x - (movex*xResist), temp.y + (movey*yResist), temp.z);
-			patches[i].pts[j / 4][j % 4].point = temp;
+// Tessellation
+void UpdatePatches(){
+	// on the worker threads, blend precomputed surfaces for a new curve strength and compute
+	// vertices, normals of patches with moved control points; then upload changed patches
+	// from this (the GL) thread
+	int nDirty = 0;
+	BezierPatch *dirtyPtrs[npatches];
+	double start = Seconds();
+	blade.BeginFrame();
+	bool resized[npatches] = {false};
+	if (adaptiveRes) {
+		// res for each patch's size in last frame's view
+		int newRes[npatches], width = glutGet(GLUT_WINDOW_WIDTH), height = glutGet(GLUT_WINDOW_HEIGHT);
+		for (int i = 0; i < npatches; i++) {
+			newRes[i] = ScreenRes(patches[i], fullview, width, height, patches[i].res);
+			resized[i] = newRes[i] != patches[i].res;
 		}
-		patches[i].SetVertices();
+		blade.SetRes(newRes);
+	}
+	// patches without resistance are unchanged by curve strength
+	int nCurved = 0;
+	BezierPatch *curvedPtrs[npatches];
+	for (int i = 0; i < npatches; i++)
+		if (patches[i].Curves())
+			curvedPtrs[nCurved++] = patchPtrs[i];
+	if (curveChanged && gpuCurve && blade.format == VertexFloat && !adaptiveRes && !curvatureSampling)
+		// move control points only, upload blend grids if not already on GPU
+		// (blend grids need float streams, shared res and uniform samples, else blend on the CPU)
+		for (int i = 0; i < npatches; i++) {
+			if (!patches[i].Curves())
+				continue;
+			patches[i].BlendPoints(curveyness.GetValue());
+			if (!patches[i].gpuBlend)
+				patches[i].UploadBlend();
+		}
+	else if (curveChanged)
+		BlendPatches(threaded? pool : NULL, curvedPtrs, nCurved, curveyness.GetValue());
+	if (curvatureSampling && !adaptiveRes) {
+		// res for each patch's curvature, within the vertices of uniform res, once the control
+		// points have moved (by edit or blend)
+		for (int i = 0; i < npatches && !budgetChanged; i++)
+			budgetChanged = patches[i].IsDirty();
+		if (budgetChanged || curveChanged) {
+			int newRes[npatches];
+			BudgetRes(patchPtrs, npatches, npatches*res*res, newRes);
+			for (int i = 0; i < npatches; i++)
+				resized[i] = newRes[i] != patches[i].res;
+			blade.SetRes(newRes);
+		}
+	}
+	curveChanged = budgetChanged = false;
+	for (int i = 0; i < npatches; i++)
+		if (patches[i].IsDirty())
+			dirtyPtrs[nDirty++] = patchPtrs[i];
+	TessellatePatches(threaded? pool : NULL, dirtyPtrs, nDirty);
+	// close cracks along boundaries of changed patches, which open only between differing res or
+	// samples (not possible for GPU blending)
+	vector<bool> changed(npatches);
+	bool blended = false;
+	for (int i = 0; i < npatches; i++) {
+		changed[i] = resized[i] || patches[i].NeedsUpload();
+		blended = blended || patches[i].gpuBlend;
 	}
+	if (!blended && (adaptiveRes || curvatureSampling))
+		StitchEdges(patchPtrs, sharedEdges, changed);
+	double tessellated = Seconds();
+	nUpdated = 0;
+	for (int i = 0; i < npatches; i++)
+		if (patches[i].NeedsUpload()) {
+			patches[i].Upload();
+			nUpdated++;
+		}
+	tessTime = tessellated-start;
+	uploadTime = Seconds()-tessellated;
+}
+
+// Curvature Correction (patches blended by next Display, as Curve(k*s, 2*k*s) would set them)
+void CC(){
+	curveChanged = true;
 }
 
 // resets the control points to thier original positions
 void reset(){
-	for (int i = 0; i < npatches; i++){
-		for (int j = 0; j < 16; j++){
-			patches[i].pts[j / 4][j % 4].point = patches[i].pts[j / 4][j % 4].origPoint;
-		}
-		patches[i].SetVertices();
-	}
+	curveChanged = false;
+	for (int i = 0; i < npatches; i++)
+		patches[i].Reset();
 }
 // Display
 
 void Display() {
+	GLSL::ResetCounts();
+	// bring geometry up to date with all edits since last frame, however many events there were
+	UpdatePatches();
     // background, blending, zbuffer
     glClearColor(.2f, .2f, .2f, 1);
     glClear(GL_COLOR_BUFFER_BIT);
-    glEnable(GL_BLEND);
-    glEnable(GL_POINT_SMOOTH);
-    glEnable(GL_LINE_SMOOTH);
-    glHint(GL_LINE_SMOOTH_HINT, GL_NICEST);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glEnable(GL_DEPTH_TEST);
+    GLSL::Enable(GL_BLEND);
+	if (!CoreProfile())
+		GLSL::Enable(GL_POINT_SMOOTH);
+    GLSL::Enable(GL_LINE_SMOOTH);
+    GLSL::Hint(GL_LINE_SMOOTH_HINT, GL_NICEST);
+    GLSL::BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    GLSL::Enable(GL_DEPTH_TEST);
     glClear(GL_DEPTH_BUFFER_BIT);
 	// update matrices
 	modelview = Translate(0, 0, -5)*rotM;
@@ -81,24 +169,49 @@ void Display() {
 	float aspect = (float) glutGet(GLUT_WINDOW_WIDTH) / (float) glutGet(GLUT_WINDOW_HEIGHT);
 	persp = Perspective(fov, aspect, nearPlane, farPlane);
 	fullview = persp*modelview;
+	SetCamera(modelview, persp);
 	// draw patch
-	for (int i = 0; i < npatches; i++) {
-		Patch &p = patches[i];
-		p.UseShader(modelview, persp);
-		if (viewShadedPatch)
-			p.Shade(modelview, persp, vec3(1, .7f, 0), vec3(.75f, .75f, .75f)); 
-		if (viewLinedPatch)
-			p.Draw(modelview, persp, vec3(0, 1, 1));
-		if (viewControlMesh)
-			p.DrawControlMesh(persp*modelview, vec3(0, .5f, 0), vec3(1, 0, 0));
-	}
-	// draw butttons in 2D screen space
-	UseDrawShader(ScreenMode());
+	// lines over shaded are drawn in the shading pass
+	vec3 wireColor(0, 1, 1);
+	if (viewShadedPatch)
+		blade.Shade(vec3(1, .7f, 0), vec3(.75f, .75f, .75f), viewLinedPatch? &wireColor : NULL); 
+	else if (viewLinedPatch)
+		blade.Draw(wireColor);
+	if (viewControlMesh)
+		blade.DrawControlMesh(vec3(0, .5f, 0), vec3(1, 0, 0));
+	blade.EndFrame();
+	// draw butttons in 2D screen space, batched
+	UseDrawShader(ScreenView);
+	BeginDraw();
 	viewControlMeshBut.Draw("control mesh", viewControlMesh? blk : NULL);
 	viewShadedPatchBut.Draw("shaded", viewShadedPatch? blk : NULL);
 	viewLinedPatchBut.Draw("lines", viewLinedPatch? blk : NULL);
 	viewCurveBut.Draw("enable curve", viewCurve? blk : NULL);
+	threadedBut.Draw("threads", threaded? blk : NULL);
+	gpuCurveBut.Draw("GPU curve", gpuCurve? blk : NULL);
+	char buf[100];
+	sprintf(buf, "tessellate %.2f ms, upload %.2f ms (%i patches, %i threads)",
+		1000*tessTime, 1000*uploadTime, nUpdated, threaded? pool->NThreads() : 1);
+	if (!CoreProfile())
+		glColor3fv(wht);
+	Text(30, 200, buf);
+	sprintf(buf, "%i location lookups, %i uniform sets, %i state calls filtered",
+		GLSL::nLookups, GLSL::nUniformSets, GLSL::nFiltered);
+	Text(30, 220, buf);
+	const char *formats[] = {"float", "interleaved", "half"}, *orders[] = {"row", "tipsify", "forsyth"};
+	sprintf(buf, "%s vertices, %i bytes each", formats[blade.format], VertexBytes(blade.format));
+	Text(30, 240, buf);
+	Topology *t = patches[0].topology;
+	float acmr = blade.strips? ACMR(&t->strips[0], t->strips.size(), 16, true) :
+							   ACMR((int *) &t->triangles[0], 3*t->triangles.size(), 16);
+	sprintf(buf, "%s, ACMR %.3f (FIFO of 16)", blade.strips? "strips" : orders[triangleOrder], acmr);
+	Text(30, 260, buf);
+	sprintf(buf, "%s res, %i vertices", adaptiveRes? "adaptive" : curvatureSampling? "budgeted" : "uniform", blade.nVerts);
+	Text(30, 280, buf);
+	sprintf(buf, "%s samples", curvatureSampling? "curvature" : "uniform");
+	Text(30, 300, buf);
 	curveyness.Draw("Curve Strength", blk);
+	EndDraw();
 	glFlush();
 }
 
@@ -114,6 +227,8 @@ vec3 *PickPoint(int x, int y, bool rightButton) {
 			if (dsq < dsqmin) {
 				dsqmin = dsq;
 				ret = pt;
+				pickedPatch = i;
+				pickedPoint = k;
 			}
 		}
 	}
@@ -133,6 +248,13 @@ void MouseButton(int butn, int state, int x, int y) {
 			viewLinedPatch = !viewLinedPatch;
 		else if (viewShadedPatchBut.Hit(x, y))
 			viewShadedPatch = !viewShadedPatch;
+		else if (threadedBut.Hit(x, y))
+			threaded = !threaded;
+		else if (gpuCurveBut.Hit(x, y)) {
+			gpuCurve = !gpuCurve;
+			if (viewCurve)
+				CC();
+		}
 		else if (viewCurveBut.Hit(x, y)){
 			viewCurve = !viewCurve;
 			if (viewCurve)
@@ -149,6 +271,8 @@ void MouseButton(int butn, int state, int x, int y) {
 			!viewLinedPatchBut.Hit(x, y) &&
 			!viewShadedPatchBut.Hit(x, y) &&
 			!viewCurveBut.Hit(x, y) &&
+			!threadedBut.Hit(x, y) &&
+			!gpuCurveBut.Hit(x, y) &&
 			!curveyness.Hit(x, y)) {
 				vec3 *pp = viewControlMesh? PickPoint(x, y, butn == GLUT_RIGHT_BUTTON) : NULL;
 				bool curvePt = false;
@@ -172,8 +296,7 @@ void MouseDrag(int x, int y) {
 	y = glutGet(GLUT_WINDOW_HEIGHT) - y;
 	if (ptMover.IsPicked()) {
 		ptMover.Drag(x, y, modelview, persp);
-		for (int i = 0; i < npatches; i++)
-			patches[i].SetVertices();
+		patches[pickedPatch].MarkDirty(pickedPoint/4, pickedPoint%4);
 	}else if(curveyness.Hit(x, y)){
 		curveyness.Mouse(x, y);
 		if (viewCurve)
@@ -185,6 +308,61 @@ void MouseDrag(int x, int y) {
     glutPostRedisplay();
 }
 
+// Keyboard
+
+void Keyboard(unsigned char key, int x, int y) {
+	if (key == 'r') {
+		TessellationReport(patches[0]);
+		VertexFormatReport(patches[0]);
+		ACMRReport();
+		SamplingReport(patches[0]);
+	}
+	if (key == 'f') {
+		// cycle vertex format of the blade's buffer
+		blade.SetFormat((VertexFormat) ((blade.format+1)%(VertexHalf+1)));
+		curveChanged = viewCurve;	// back to float: GPU curve resumes with blend grids
+		glutPostRedisplay();
+	}
+	if (key == 'o') {
+		// cycle triangle order of the element buffers
+		triangleOrder = (TriangleOrder) ((triangleOrder+1)%(ForsythOrder+1));
+		ReorderTriangles(triangleOrder);
+		glutPostRedisplay();
+	}
+	if (key == 's') {
+		blade.strips = !blade.strips;
+		glutPostRedisplay();
+	}
+	if (key == 'a') {
+		// toggle per-patch res; back to uniform res when off
+		adaptiveRes = !adaptiveRes;
+		if (!adaptiveRes && !curvatureSampling) {
+			int uniformRes[npatches];
+			for (int i = 0; i < npatches; i++)
+				uniformRes[i] = res;
+			blade.SetRes(uniformRes);
+		}
+		budgetChanged = !adaptiveRes && curvatureSampling;
+		curveChanged = viewCurve;
+		glutPostRedisplay();
+	}
+	if (key == 'c') {
+		// toggle curvature-spaced samples; back to uniform res when off
+		curvatureSampling = !curvatureSampling;
+		for (int i = 0; i < npatches; i++)
+			patches[i].SetSampleMode(curvatureSampling? BezierPatch::CurvatureSamples : BezierPatch::UniformSamples);
+		if (!curvatureSampling && !adaptiveRes) {
+			int uniformRes[npatches];
+			for (int i = 0; i < npatches; i++)
+				uniformRes[i] = res;
+			blade.SetRes(uniformRes);
+		}
+		budgetChanged = curvatureSampling;
+		curveChanged = viewCurve;
+		glutPostRedisplay();
+	}
+}
+
 // Patches
 vec3			cp[npatches - nTpatches][4];			// Corner points array (not including tip point)
 vec3			tipPoint = vec3(.56f*s, .02f*s, 0.f);	// tip of sword
@@ -228,6 +406,7 @@ void InitPatches(){
 
 	// initilize original points
 	for (int i = 0; i < npatches; i++){
+		patchPtrs[i] = &patches[i];
 		for (int j = 0; j < 16; j++){
 			patches[i].pts[j / 4][j % 4].origPoint = patches[i].pts[j / 4][j % 4].point;
 		}
@@ -261,21 +440,35 @@ void setResis(){
 int main(int ac, char **av) {
     // init app window
     glutInit(&ac, av);
+	bool core = ac > 1 && !strcmp(av[1], "-core");
+	if (core) {
+		// core profile: geometry only (no raster text, wide lines or point smoothing)
+		glutInitContextVersion(4, 0);
+		glutInitContextProfile(GLUT_CORE_PROFILE);
+	}
     glutInitWindowSize(1500, 1000);
     glutInitWindowPosition(0, 0);
     glutCreateWindow("Katana Blade");
+	glewExperimental = core;	// else GLEW skips entry points a core context doesn't list
 	GLenum err = glewInit();
 	if (err != GLEW_OK)
         printf("Error initializaing GLEW: %s\n", glewGetErrorString(err));
+	glGetError();			// glewInit's query of GL_EXTENSIONS fails under core
 	// init patch
+	pool = new ThreadPool();
 	Points();
 	InitPatches();
 	setResis();
+	for (int i = 0; i < npatches; i++)
+		patches[i].SetBlend(s, 2*s);
+	blade.Init(patches, npatches);
+	FindSharedEdges(patchPtrs, npatches, sharedEdges);
 	if (viewCurve)
 		CC();
     // callbacks
     glutDisplayFunc(Display);
     glutMouseFunc(MouseButton);
     glutMotionFunc(MouseDrag);
+	glutKeyboardFunc(Keyboard);
     glutMainLoop();
 }
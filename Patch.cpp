@@ -1,5 +1,7 @@
 // Patch.cpp
 
+#include <stddef.h>
+#include <string.h>
 #include "glew.h"
 #include "freeglut.h"
 #include "Draw.h"
@@ -7,168 +9,274 @@
 #include "Patch.h"
 #include "mat.h"
 
-// Evaluation
+// Initialization
 
-static vec3 BezTangent(float t, vec3 &b1, vec3 &b2, vec3 &b3, vec3 &b4) {
-    float t2 = t*t, t3 = t*t2;
-	vec3 p = (-3*t2+6*t-3)*b1+(9*t2-12*t+3)*b2+(6*t-9*t2)*b3+3*t2*b4;
-    return normalize(p);
-}
+Patch::Patch() : vBufferId(0), indices(NULL), uploadedVersion(-1), gpuBlend(false),
+				 blade(NULL), baseVertex(0), streamVerts(0), sliceVertex(0), slot(0), slotFrame(0),
+				 boxCenter(0, 0, 0), boxScale(1, 1, 1), boxIndex(0) { }
 
-static vec3 BezPoint(float t, vec3 &b1, vec3 &b2, vec3 &b3, vec3 &b4) {
-    float t2 = t*t, t3 = t*t2;
-    return vec3((-t3+3*t2-3*t+1)*b1+(3*t3-6*t2+3*t)*b2+(3*t2-3*t3)*b3+t3*b4);
+void Patch::SetRes(int res) {
+	BezierPatch::SetRes(res);
+	UploadIndices();
+	if (blade)
+		blade->Layout();	// base vertices of following patches move
+	else
+		Upload();
 }
 
-vec3 Patch::Point(float s, float t) {
-	vec3 spts[4];
-	SPts(s, spts);
-	return BezPoint(t, spts[0], spts[1], spts[2], spts[3]);
+void Patch::Init(int res, vec3 p0,  vec3 p1,  vec3 p2,  vec3 p3,
+		                  vec3 p4,  vec3 p5,  vec3 p6,  vec3 p7, 
+					      vec3 p8,  vec3 p9,  vec3 p10, vec3 p11,
+					      vec3 p12, vec3 p13, vec3 p14, vec3 p15) {
+	BezierPatch::Init(res, p0, p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15);
+	glGenBuffers(1, &vBufferId);
+	UploadIndices();
+	Upload();
 }
 
-vec3 Patch::Normal(float s, float t) {
-	vec3 spts[4], tpts[4];
-	for (int c = 0; c < 4; c++) {
-		spts[c] = BezPoint(s, pts[0][c].point, pts[1][c].point, pts[2][c].point, pts[3][c].point);
-		tpts[c] = BezPoint(t, pts[c][0].point, pts[c][1].point, pts[c][2].point, pts[c][3].point);
-	}
-	vec3 sTan = BezTangent(s, tpts[0], tpts[1], tpts[2], tpts[3]);
-	vec3 tTan = BezTangent(t, spts[0], spts[1], spts[2], spts[3]);
-	return normalize(cross(sTan, tTan));
+void Patch::Init(int res, vec3 p0, vec3 p1, vec3 p2, vec3 p3) {
+	BezierPatch::Init(res, p0, p1, p2, p3);
+	glGenBuffers(1, &vBufferId);
+	UploadIndices();
+	Upload();
 }
 
-void Patch::Eval(float s, float t, vec3 &point, vec3 &sTan, vec3 &tTan, vec3 *normal) {
-	vec3 spts[4], tpts[4];
-	for (int c = 0; c < 4; c++) {
-		spts[c] = BezPoint(s, pts[c][0].point, pts[c][1].point, pts[c][2].point, pts[c][3].point);
-		tpts[c] = BezPoint(t, pts[0][c].point, pts[1][c].point, pts[2][c].point, pts[3][c].point);
+void Patch::WriteBytes(int offset, int size, void *data) {
+	// copy to vBufferId (assumed bound)
+	if (!blade) {
+		glBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
+		return;
+	}
+	// the slot is not being drawn (see NextSlot), so write without waiting on the GPU
+	GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+	void *dst = glMapBufferRange(GL_ARRAY_BUFFER, offset, size, access);
+	if (dst) {
+		memcpy(dst, data, size);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
 	}
-	point = BezPoint(t, spts[0], spts[1], spts[2], spts[3]);
-	tTan = BezTangent(t, spts[0], spts[1], spts[2], spts[3]); // spts define t-curve
-	sTan = BezTangent(s, tpts[0], tpts[1], tpts[2], tpts[3]); // tpts define s-curve
-	if (normal)
-		*normal = normalize(cross(sTan, tTan));
 }
 
-// Initialization
+void Patch::WriteStream(int stream, vector<vec3> &data) {
+	// copy res*res vectors to attribute stream of vBufferId
+	WriteBytes((stream*streamVerts+baseVertex)*sizeof(vec3), res*res*sizeof(vec3), &data[0]);
+}
 
-void Patch::SetRes(int res) {
-	this->res = res;
-	SetVertices();
-	SetTriangles();
+void Patch::WritePacked() {
+	// one interleaved stream; half positions are relative to this upload's bounds
+	VertexFormat format = Format();
+	int n = res*res, bytes = VertexBytes(format);
+	vector<char> packed(n*bytes);
+	VertexBox(&vertices[0], n, boxCenter, boxScale);
+	PackVertices(format, &vertices[0], &normals[0], n, boxCenter, boxScale, boxIndex, &packed[0]);
+	WriteBytes(baseVertex*bytes, n*bytes, &packed[0]);
 }
 
-void Patch::Init(int res, vec3 p0,  vec3 p1,  vec3 p2,  vec3 p3,
-		                  vec3 p4,  vec3 p5,  vec3 p6,  vec3 p7, 
-					      vec3 p8,  vec3 p9,  vec3 p10, vec3 p11,
-					      vec3 p12, vec3 p13, vec3 p14, vec3 p15) {
-    vec3 *tmp[] = {&p0, &p1, &p2,  &p3,  &p4,  &p5,  &p6,  &p7,
-		           &p8, &p9, &p10, &p11, &p12, &p13, &p14, &p15};
-	for (int i = 0; i < 16; i++){
-		pts[i / 4][i % 4].point = *(tmp[i]);
-	}
-	glGenBuffers(1, &vBufferId);
-	SetRes(res);
+void Patch::NextSlot() {
+	// in a blade, write each frame's update to the next of Blade::NSlots copies, which the
+	// GPU last drew at least NSlots frames ago (Blade::BeginFrame waits for those draws)
+	if (slotFrame == blade->frame)
+		return;					// already moved this frame; slot not yet drawn
+	slot = (slot+1)%Blade::NSlots;
+	slotFrame = blade->frame;
+	baseVertex = slot*blade->nVerts+sliceVertex;
 }
 
-void Patch::Init(int res, vec3 p0, vec3 p1, vec3 p2, vec3 p3) {
-	float vals[] = {0, 1/3.f, 2/3.f, 1.};
-	for (int i = 0; i < 16; i++) {
-		float ax = vals[i%4], ay = vals[i/4];
-		vec3 p10 = p0+ax*(p1-p0), p32 = p2+ax*(p3-p2);
-		pts[i / 4][i % 4].point = p10 + ay*(p32 - p10);
+static void SetStreams(GLuint vArrayId, GLuint vBufferId, int streamVerts, int nArrays,
+					   VertexFormat format = VertexFloat) {
+	// record in vArrayId: attribute i is stream i of vBufferId, enabled if i < nArrays;
+	// interleaved formats have only position and normal, the latter as unnormalized shorts
+	GLSL::BindVertexArray(vArrayId);
+	GLSL::BindBuffer(GL_ARRAY_BUFFER, vBufferId);
+	if (format != VertexFloat) {
+		GLsizei stride = VertexBytes(format);
+		if (format == VertexHalf) {
+			glVertexAttribPointer(0, 4, GL_HALF_FLOAT, GL_FALSE, stride, (void *) 0);
+			glVertexAttribPointer(1, 2, GL_SHORT, GL_FALSE, stride, (void *) offsetof(HalfVertex, normal));
+		}
+		else {
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void *) 0);
+			glVertexAttribPointer(1, 2, GL_SHORT, GL_FALSE, stride, (void *) offsetof(InterleavedVertex, normal));
+		}
+		nArrays = 2;
 	}
-	glGenBuffers(1, &vBufferId);
-	SetRes(res);
+	for (int i = 0; i < 5; i++) {
+		if (i < nArrays && format == VertexFloat)
+			glVertexAttribPointer(i, 3, GL_FLOAT, GL_FALSE, 0, (void *) (i*streamVerts*sizeof(vec3)));
+		if (i < nArrays)
+			glEnableVertexAttribArray(i);
+		else
+			glDisableVertexAttribArray(i);
+	}
+	GLSL::BindVertexArray(0);
 }
 
-void Patch::SPts(float s, vec3 spts[]) {
-	for (int c = 0; c < 4; c++)
-		spts[c] = BezPoint(s, pts[c][0].point, pts[c][1].point, pts[c][2].point, pts[c][3].point);
+VertexFormat Patch::Format() {
+	return blade? blade->format : VertexFloat;
 }
 
-void Patch::TPts(float t, vec3 tpts[]) {
-	// set tpts[0..3] each t-distance along the 4 t-curves; in other words, tpts[] defines an s-curve
-	for (int c = 0; c < 4; c++)
-		tpts[c] = BezPoint(t, pts[0][c].point, pts[1][c].point, pts[2][c].point, pts[3][c].point);
+void Patch::Allocate(bool blend) {
+	// own buffer (until moved into a blade): allocate room for the five blend streams,
+	// discarding old contents
+	streamVerts = res*res;
+	gpuBlend = blend;
+	glBufferData(GL_ARRAY_BUFFER, 5*streamVerts*sizeof(vec3), NULL, GL_DYNAMIC_DRAW);
 }
 
-void Patch::SetVertices() {
+void Patch::Upload() {
 	// make GPU vertex buffer active
-	glBindBuffer(GL_ARRAY_BUFFER, vBufferId);
-	// get pointers to GPU memory for vertices, normals
-	int nVerts = res*res, vSize = nVerts*sizeof(vec3);
-	glBufferData(GL_ARRAY_BUFFER, 2*vSize, NULL, GL_STATIC_DRAW);
-	vec3 *vPtr = (vec3 *) glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
-	vec3 *nPtr = vPtr+nVerts;
-	// set res by res vertices
-	vec3 spts[4], tpts[4];
-	for (int i = 0; i < res; i++) {
-		float s = (float) i /(res-1);
-		SPts(s, spts); // defines a t-curve
-		for (int j = 0; j < res; j++) {
-			float t = (float) j/(res-1);
-			TPts(t, tpts); // defines an s-curve
-			vec3 sTan = BezTangent(s, tpts[0], tpts[1], tpts[2], tpts[3]);
-			vec3 tTan = BezTangent(t, spts[0], spts[1], spts[2], spts[3]);
-			// write directly to GPU memory
-			*vPtr++ = BezPoint(t, spts[0], spts[1], spts[2], spts[3]);
-			*nPtr++ = normalize(cross(sTan, tTan));
+	GLSL::BindBuffer(GL_ARRAY_BUFFER, vBufferId);
+	if (!blade)
+		Allocate(false);
+	else {
+		NextSlot();
+		if (gpuBlend && Format() == VertexFloat) {
+			// shared buffer always draws five attributes, so clear displacement and normal
+			// terms in every slot (rare, so let the driver synchronize)
+			vector<vec3> zero(res*res, vec3(0, 0, 0));
+			for (int s = 0; s < Blade::NSlots; s++)
+				for (int i = 2; i < 5; i++) {
+					int offset = (i*streamVerts+s*blade->nVerts+sliceVertex)*sizeof(vec3);
+					glBufferSubData(GL_ARRAY_BUFFER, offset, res*res*sizeof(vec3), &zero[0]);
+				}
 		}
 	}
-	glUnmapBuffer(GL_ARRAY_BUFFER);
+	if (Format() != VertexFloat)
+		WritePacked();
+	else {
+		WriteStream(0, vertices);
+		WriteStream(1, normals);
+	}
+	uploadedVersion = version;
+	gpuBlend = false;
 }
 
-void Patch::SetTriangles() {
-	int tri = 0;
-	triangles.resize(2*(res-1)*(res-1));
-	for (int j1 = 1; j1 < res; j1++)
-		for (int i1 = 1; i1 < res; i1++) {
-			int i0 = i1-1, j0 = j1-1;
-			int v1 = j0*res+i0, v2 = j0*res+i1, v3 = j1*res+i1, v4 = j1*res+i0;
-			triangles[tri++] = int3(v1, v2, v3);
-			triangles[tri++] = int3(v1, v3, v4);
-		}
-	SetSegments();
+void Patch::UploadBlend() {
+	// in order of shader attribute locations: base, normal, displacement, normal1, normal2
+	if (blendRes != res)
+		SetBlend(blendScale.x, blendScale.y);
+	vector<vec3> *grids[] = {&blendBase, &blendCross[0], &blendDelta, &blendCross[1], &blendCross[2]};
+	GLSL::BindBuffer(GL_ARRAY_BUFFER, vBufferId);
+	if (!blade)
+		Allocate(true);
+	else
+		NextSlot();
+	for (int i = 0; i < 5; i++)
+		WriteStream(i, *grids[i]);
+	gpuBlend = true;
+}
+
+template <class T>
+static void UploadElements(unsigned int bufferId, int *indices, int count) {
+	// copy count indices, narrowed to T, to element buffer
+	// (via a non-VAO target: element array binding is vertex array state)
+	vector<T> narrow(indices, indices+count);
+	GLSL::BindBuffer(GL_COPY_WRITE_BUFFER, bufferId);
+	glBufferData(GL_COPY_WRITE_BUFFER, count*sizeof(T), &narrow[0], GL_STATIC_DRAW);
+}
+
+struct IndexBuffers {
+	GLuint tBufferId, sBufferId;	// GPU element buffers for triangles, segments
+	GLuint pBufferId;				// triangle strips, separated by restartIndex
+	GLenum indexType;				// GL_UNSIGNED_SHORT if res*res < 65536, else GL_UNSIGNED_INT
+	GLuint restartIndex;			// Topology::RestartIndex narrowed to indexType
+	int    nTriIndices, nSegIndices, nStripIndices;
+};
+
+static vector<IndexBuffers *> indexBuffers; // indexed by res
+
+static void UploadTopology(IndexBuffers *ib, Topology *topology) {
+	int res = topology->res;
+	int *tris = (int *) &topology->triangles[0], *segs = (int *) &topology->segments[0];
+	int *strips = &topology->strips[0];
+	int nTriIndices = ib->nTriIndices = 3*topology->triangles.size();
+	int nSegIndices = ib->nSegIndices = 2*topology->segments.size();
+	int nStripIndices = ib->nStripIndices = topology->strips.size();
+	if (res*res < 65536) {
+		ib->indexType = GL_UNSIGNED_SHORT;
+		ib->restartIndex = (GLushort) Topology::RestartIndex;
+		UploadElements<GLushort>(ib->tBufferId, tris, nTriIndices);
+		UploadElements<GLushort>(ib->sBufferId, segs, nSegIndices);
+		UploadElements<GLushort>(ib->pBufferId, strips, nStripIndices);
+	}
+	else {
+		ib->indexType = GL_UNSIGNED_INT;
+		ib->restartIndex = (GLuint) Topology::RestartIndex;
+		UploadElements<GLuint>(ib->tBufferId, tris, nTriIndices);
+		UploadElements<GLuint>(ib->sBufferId, segs, nSegIndices);
+		UploadElements<GLuint>(ib->pBufferId, strips, nStripIndices);
+	}
 }
 
-static int CompareInt2(const void *arg1, const void *arg2) {
-  int2 *p1 = (int2*) arg1, *p2 = (int2*) arg2;
-  return p1->i1 == p2->i1? (p1->i2 < p2->i2? -1 : 1) : p1->i1 < p2->i1? -1 : 1;
+void Patch::UploadIndices() {
+	if ((int) indexBuffers.size() <= res)
+		indexBuffers.resize(res+1, NULL);
+	indices = indexBuffers[res];
+	if (indices)
+		return;
+	indices = indexBuffers[res] = new IndexBuffers;
+	glGenBuffers(1, &indices->tBufferId);
+	glGenBuffers(1, &indices->sBufferId);
+	glGenBuffers(1, &indices->pBufferId);
+	UploadTopology(indices, topology);
 }
 
-void Patch::SetSegments() {
-	// there are res rows and res columns of res-1 segments
-	int nsegments = 2*res*(res-1), count = 0;
-	segments.resize(nsegments);
-	for (int i = 0; i < res; i++)
-		for (int j = 0; j < res-1; j++)
-			// in row i, add segment from column j to j+1, ie vertex i*(res-1)+j to i*(res-1)+j+1
-			segments[count++] = int2(i*res+j, i*res+j+1);
-	for (int j = 0; j < res; j++)
-		for (int i = 0; i < res-1; i++)
-			// in column j, add segment from row i to row i+1, ie vertex i*(res-1)+j to i*(res-1)+j+res
-			segments[count++] = int2(i*res+j, i*res+j+res);
+void ReorderTriangles(TriangleOrder order) {
+	SetTriangleOrder(order);
+	for (int res = 0; res < (int) indexBuffers.size(); res++)
+		if (indexBuffers[res])
+			UploadTopology(indexBuffers[res], GetTopology(res));
+}
+
+bool Patch::NeedsUpload() {
+	return uploadedVersion != version;
 }
 
 // GLSL Rendering
 
 char *gouraudVShader = "\
 	#version 400															\n\
-	layout (location = 0) in vec3 position;									\n\
-	layout (location = 1) in vec3 normal;									\n\
+	layout (location = 0) in vec4 position;	// w: box index if VertexHalf	\n\
+	layout (location = 1) in vec3 normal;	// xy: octahedral if interleaved\n\
+	layout (location = 2) in vec3 displacement; // per unit curveyness		\n\
+	layout (location = 3) in vec3 normal1;									\n\
+	layout (location = 4) in vec3 normal2;									\n\
 	out vec4 vPosition;														\n\
 	out float intensity;													\n\
-    uniform mat4 modelview;													\n\
-	uniform mat4 persp;														\n\
+	flat out int vid;														\n\
+	layout (std140, row_major) uniform Camera {								\n\
+		mat4 modelview, persp, fullview, screen;							\n\
+		vec4 viewport;														\n\
+	};																		\n\
 	uniform vec3 light;														\n\
+	uniform float curveyness = 0;											\n\
+	uniform int vertexFormat = 0;	// VertexFloat, VertexInterleaved, VertexHalf\n\
+	uniform vec3 boxCenter[64], boxScale[64];	// Blade::MaxBoxes			\n\
+	vec3 OctDecode(vec2 e)													\n\
+	{																		\n\
+		vec3 n = vec3(e, 1-abs(e.x)-abs(e.y));								\n\
+		if (n.z < 0)														\n\
+			n.xy = (1-abs(n.yx))*vec2(n.x < 0? -1 : 1, n.y < 0? -1 : 1);	\n\
+		return n;	// normalized below										\n\
+	}																		\n\
 	void main()																\n\
 	{																		\n\
-		vPosition = modelview*vec4(position, 1);							\n\
+		// attributes 2-4 are zero unless the buffer holds blend grids		\n\
+		float k = curveyness;												\n\
+		vec3 p = position.xyz, n = normal;									\n\
+		if (vertexFormat > 0)												\n\
+			n = OctDecode(normal.xy/32767.);								\n\
+		if (vertexFormat == 2) {											\n\
+			int b = int(position.w);										\n\
+			p = boxCenter[b]+boxScale[b]*p;									\n\
+		}																	\n\
+		p += k*displacement;												\n\
+		n += k*(normal1+k*normal2);											\n\
+		vPosition = modelview*vec4(p, 1);									\n\
 		gl_Position = persp*vPosition;										\n\
 		vec3 lightV = normalize(light-vPosition.xyz);						\n\
-		vec4 xnormal = modelview*vec4(normal, 0);							\n\
+		vec4 xnormal = modelview*vec4(n, 0);								\n\
 		intensity = clamp(abs(dot(normalize(xnormal.xyz), lightV)), 0, 1);	\n\
+		vid = gl_VertexID;													\n\
 	}\n";
 
 char *gouraudFShader = "\
@@ -181,61 +289,322 @@ char *gouraudFShader = "\
 		fColor = vec4(intensity*color, 1);									\n\
 	}\n";
 
-static GLuint shaderProgram = 0;
+// wireframe overlay: the geometry shader gives each fragment its pixel distance to the
+// triangle's grid edges; the diagonal, whose vertices are res+1 apart against 1 or res
+// for grid edges, is the edge of largest vertex id difference (base vertex cancels)
+
+char *gouraudWireGShader = "\
+	#version 400															\n\
+	layout (triangles) in;													\n\
+	layout (triangle_strip, max_vertices = 3) out;							\n\
+	layout (std140, row_major) uniform Camera {								\n\
+		mat4 modelview, persp, fullview, screen;							\n\
+		vec4 viewport;														\n\
+	};																		\n\
+	in float intensity[];													\n\
+	flat in int vid[];														\n\
+	out float gIntensity;													\n\
+	noperspective out vec3 edgeDist;										\n\
+	void main()																\n\
+	{																		\n\
+		vec2 p[3];															\n\
+		int d[3];	// id difference across edge opposite vertex i			\n\
+		for (int i = 0; i < 3; i++) {										\n\
+			p[i] = .5*viewport.xy*gl_in[i].gl_Position.xy/gl_in[i].gl_Position.w;\n\
+			d[i] = abs(vid[(i+1)%3]-vid[(i+2)%3]);							\n\
+		}																	\n\
+		int diag = d[0] > d[1]? (d[0] > d[2]? 0 : 2) : (d[1] > d[2]? 1 : 2);\n\
+		vec2 a = p[1]-p[0], b = p[2]-p[0];									\n\
+		float area2 = abs(a.x*b.y-a.y*b.x);									\n\
+		for (int i = 0; i < 3; i++) {										\n\
+			float len = length(p[(i+1)%3]-p[(i+2)%3]);						\n\
+			vec3 e = vec3(0);												\n\
+			e[i] = area2/max(len, 1e-6);	// altitude from vertex i		\n\
+			e[diag] = 1e6;													\n\
+			gl_Position = gl_in[i].gl_Position;								\n\
+			gIntensity = intensity[i];										\n\
+			edgeDist = e;													\n\
+			EmitVertex();													\n\
+		}																	\n\
+		EndPrimitive();														\n\
+	}\n";
+
+char *gouraudWireFShader = "\
+	#version 400															\n\
+	in float gIntensity;													\n\
+	noperspective in vec3 edgeDist;											\n\
+	uniform vec3 color;														\n\
+	uniform vec3 wireColor;													\n\
+	out vec4 fColor;														\n\
+	void main()																\n\
+	{																		\n\
+		float d = min(edgeDist.x, min(edgeDist.y, edgeDist.z));				\n\
+		float wire = exp2(-2*d*d);	// about a pixel wide, antialiased		\n\
+		fColor = vec4(mix(gIntensity*color, wireColor, wire), 1);			\n\
+	}\n";
+
+struct Gouraud {
+	GLuint program;
+	GLSL::Uniform light, color, curveyness, wireColor, vertexFormat, boxCenter, boxScale;
+	Gouraud() : program(0) { }
+};
+
+static Gouraud shaded, wired, *gouraud = &shaded; // gouraud as last used
 
-void Patch::UseShader(mat4 &modelview, mat4 &proj) {
-	int ntris = triangles.size();
-	int nVerts = res*res, vSize = nVerts*sizeof(vec3);
-	if (!shaderProgram) {
-		shaderProgram = GLSL::LinkProgramViaCode(gouraudVShader, gouraudFShader);
-		if (!shaderProgram) {
+static bool UseGouraud(bool wire, GLuint vArrayId, int nArrays, float k, Blade *blade) {
+	// bind vertex array, whose attributes past nArrays are disabled (read as zero);
+	// set decoding of the blade's vertex format
+	Gouraud &g = wire? wired : shaded;
+	if (!g.program) {
+		g.program = wire?
+			GLSL::LinkProgramViaCode(gouraudVShader, gouraudWireFShader, gouraudWireGShader) :
+			GLSL::LinkProgramViaCode(gouraudVShader, gouraudFShader);
+		if (!g.program) {
 			printf("Bezier.cpp: can't link shader program\n");
-			return;
+			return false;
+		}
+		g.light = GLSL::Uniform(g.program, "light");
+		g.color = GLSL::Uniform(g.program, "color");
+		g.curveyness = GLSL::Uniform(g.program, "curveyness");
+		g.wireColor = GLSL::Uniform(g.program, "wireColor");
+		g.vertexFormat = GLSL::Uniform(g.program, "vertexFormat");
+		g.boxCenter = GLSL::Uniform(g.program, "boxCenter");
+		g.boxScale = GLSL::Uniform(g.program, "boxScale");
+		BindCamera(g.program);
+	}
+	gouraud = &g;
+	GLSL::UseProgram(g.program);
+	GLSL::BindVertexArray(vArrayId);
+	for (int i = nArrays; i < 5; i++)
+		glVertexAttrib3f(i, 0, 0, 0);
+	g.curveyness.Set(k);
+	VertexFormat format = blade->format;
+	g.vertexFormat.Set((int) format);
+	if (format == VertexHalf) {
+		vector<vec3> centers(blade->npatches), scales(blade->npatches);
+		for (int i = 0; i < blade->npatches; i++) {
+			centers[i] = blade->patches[i].boxCenter;
+			scales[i] = blade->patches[i].boxScale;
+		}
+		g.boxCenter.Set(blade->npatches, &centers[0]);
+		g.boxScale.Set(blade->npatches, &scales[0]);
+	}
+	return true;
+}
+
+// Blade
+
+Blade::Blade() : patches(NULL), npatches(0), vBufferId(0), vArrayId(0), format(VertexFloat), strips(false),
+				 nVerts(0), frame(0),
+				 cageBufferId(0), cageIndexId(0), cageArrayId(0), nCageIndices(0) {
+	for (int i = 0; i < NSlots; i++)
+		fences[i] = 0;
+}
+
+void Blade::BeginFrame() {
+	// this frame's uploads reuse slots last drawn by frame-NSlots; wait for its fence
+	GLsync &fence = fences[frame%NSlots];
+	if (fence) {
+		glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);	// 1 sec
+		glDeleteSync(fence);
+		fence = 0;
+	}
+}
+
+void Blade::EndFrame() {
+	fences[frame%NSlots] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	frame++;
+}
+
+void Blade::Init(Patch *ps, int n) {
+	patches = ps;
+	npatches = n;
+	if (!vBufferId) {
+		glGenBuffers(1, &vBufferId);
+		glGenVertexArrays(1, &vArrayId);
+	}
+	for (int i = 0; i < npatches; i++) {
+		Patch &p = patches[i];
+		if (p.vBufferId && p.vBufferId != vBufferId)
+			GLSL::DeleteBuffers(1, &p.vBufferId);
+		p.vBufferId = vBufferId;
+		p.blade = this;
+		p.boxIndex = i;
+	}
+	// control mesh: points allocated here, set by UploadCage; segments fixed
+	vector<GLushort> segs;
+	for (int i = 0; i < npatches; i++) {
+		Patch &p = patches[i];
+		for (int k = 0; k < (int) p.controlSegments.size(); k++) {
+			segs.push_back(16*i+p.controlSegments[k].i1);
+			segs.push_back(16*i+p.controlSegments[k].i2);
 		}
 	}
-	glUseProgram(shaderProgram);
-	glBindBuffer(GL_ARRAY_BUFFER, vBufferId);
+	if (!cageBufferId) {
+		glGenBuffers(1, &cageBufferId);
+		glGenBuffers(1, &cageIndexId);
+		glGenVertexArrays(1, &cageArrayId);
+	}
+	GLSL::BindBuffer(GL_ARRAY_BUFFER, cageBufferId);
+	glBufferData(GL_ARRAY_BUFFER, 16*npatches*sizeof(vec3), NULL, GL_DYNAMIC_DRAW);
+	cage.resize(0);		// upload all points on next draw
+	// points at attribute 0; color, size, dash are constant per draw
+	GLSL::BindVertexArray(cageArrayId);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void *) 0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void *) vSize);
 	glEnableVertexAttribArray(0);
-	glEnableVertexAttribArray(1);
-	GLSL::SetUniform(shaderProgram, "modelview", modelview);
-	GLSL::SetUniform(shaderProgram, "persp", proj);
+	for (int i = 1; i < 5; i++)
+		glDisableVertexAttribArray(i);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cageIndexId);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, segs.size()*sizeof(GLushort), segs.size()? &segs[0] : NULL, GL_STATIC_DRAW);
+	GLSL::BindVertexArray(0);
+	nCageIndices = segs.size();
+	Layout();
+}
+
+void Blade::Layout() {
+	// each attribute stream (the one interleaved stream, if packed) holds NSlots slices
+	// of nVerts, patch i at sliceVertex in each
+	nVerts = 0;
+	for (int i = 0; i < npatches; i++) {
+		Patch &p = patches[i];
+		p.sliceVertex = p.baseVertex = nVerts;
+		p.slot = 0;
+		p.slotFrame = frame;	// fresh storage: write slot 0 now
+		nVerts += p.res*p.res;
+	}
+	GLSL::BindBuffer(GL_ARRAY_BUFFER, vBufferId);
+	if (format == VertexFloat) {
+		// zero-fill so that displacement, normal1, normal2 streams are null for unblended patches
+		vector<vec3> zero(5*NSlots*nVerts, vec3(0, 0, 0));
+		glBufferData(GL_ARRAY_BUFFER, zero.size()*sizeof(vec3), &zero[0], GL_DYNAMIC_DRAW);
+	}
+	else
+		glBufferData(GL_ARRAY_BUFFER, NSlots*nVerts*VertexBytes(format), NULL, GL_DYNAMIC_DRAW);
+	SetStreams(vArrayId, vBufferId, NSlots*nVerts, 5, format);
+	for (int i = 0; i < npatches; i++) {
+		Patch &p = patches[i];
+		p.streamVerts = NSlots*nVerts;
+		if (p.gpuBlend && format == VertexFloat)
+			p.UploadBlend();
+		else {
+			if (p.gpuBlend)
+				p.Tessellate();		// control points are already blended
+			p.Upload();
+		}
+	}
+}
+
+void Blade::SetRes(int *res) {
+	bool changed = false;
+	for (int i = 0; i < npatches; i++)
+		if (patches[i].res != res[i]) {
+			patches[i].BezierPatch::SetRes(res[i]);
+			patches[i].UploadIndices();
+			changed = true;
+		}
+	if (changed)
+		Layout();
+}
+
+void Blade::SetFormat(VertexFormat f) {
+	if (f == VertexHalf && npatches > MaxBoxes) {
+		printf("Blade::SetFormat: %i patches exceed %i boxes for half positions\n", npatches, (int) MaxBoxes);
+		return;
+	}
+	format = f;
+	Layout();
 }
 
-void Patch::Shade(mat4 &modelview, mat4 &proj, vec3 &light, vec3 &color) {
-	int ntris = triangles.size();
-	UseShader(modelview, proj);
-	GLSL::SetUniform(shaderProgram, "light", light);
-	GLSL::SetUniform(shaderProgram, "color", color);
-	glDrawElements(GL_TRIANGLES, 3*ntris, GL_UNSIGNED_INT, &triangles[0]);
+void Blade::MultiDraw(bool triangles) {
+	// one draw call per distinct res, each covering all patches of that res
+	bool strip = triangles && strips;
+	GLenum mode = strip? GL_TRIANGLE_STRIP : triangles? GL_TRIANGLES : GL_LINES;
+	if (strip)
+		GLSL::Enable(GL_PRIMITIVE_RESTART);
+	else
+		GLSL::Disable(GL_PRIMITIVE_RESTART);
+	vector<GLsizei> counts;
+	vector<GLvoid *> offsets;
+	vector<GLint> bases;
+	vector<bool> drawn(npatches, false);
+	for (int i = 0; i < npatches; i++) {
+		if (drawn[i])
+			continue;
+		IndexBuffers *ib = patches[i].indices;
+		counts.resize(0);
+		offsets.resize(0);
+		bases.resize(0);
+		for (int j = i; j < npatches; j++)
+			if (patches[j].indices == ib) {
+				counts.push_back(strip? ib->nStripIndices : triangles? ib->nTriIndices : ib->nSegIndices);
+				offsets.push_back((GLvoid *) 0);
+				bases.push_back(patches[j].baseVertex);
+				drawn[j] = true;
+			}
+		if (strip)
+			glPrimitiveRestartIndex(ib->restartIndex);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, strip? ib->pBufferId : triangles? ib->tBufferId : ib->sBufferId);
+		glMultiDrawElementsBaseVertex(mode, &counts[0], ib->indexType, &offsets[0], counts.size(), &bases[0]);
+	}
+	GLSL::BindVertexArray(0);
 }
 
-void Patch::Draw(mat4 &modelview, mat4 &proj, vec3 &color) {
-	UseShader(modelview, proj);
-	GLSL::SetUniform(shaderProgram, "color", color);
-	glDrawElements(GL_LINES, 2*segments.size(), GL_UNSIGNED_INT, &segments[0]);
+static float BladeCurveyness(Patch *patches, int npatches) {
+	// patches blended on the GPU share the curve slider; others have null displacement
+	for (int i = 0; i < npatches; i++)
+		if (patches[i].gpuBlend)
+			return patches[i].blendK;
+	return 0;
 }
 
-void Patch::DrawControlMesh(mat4 &fullview, vec3 &lineColor, vec3 &dotColor) {
-	UseDrawShader(fullview);
-    for (int k = 0; k < 16; k++)
-		Disk(pts[k / 4][k % 4].point, 7, dotColor);
-	DashOn();
-    for (int i = 0; i < 4; i++) {
-        for (int t = 0; t < 3; t++)
-			Line(pts[i][t].point, pts[i][t + 1].point, lineColor);
-        for (int s = 0; s < 3; s++)
-			Line(pts[s][i].point, pts[s + 1][i].point, lineColor);
-    }
-	DashOff();
+void Blade::Shade(vec3 &light, vec3 &color, vec3 *wireColor) {
+	if (!UseGouraud(wireColor != NULL, vArrayId, format == VertexFloat? 5 : 2, BladeCurveyness(patches, npatches), this))
+		return;
+	gouraud->light.Set(light);
+	gouraud->color.Set(color);
+	if (wireColor)
+		gouraud->wireColor.Set(*wireColor);
+	MultiDraw(true);
 }
 
-void Patch::SetControlSegments() {
-	int segs[][2] = {{0,1},{1,2},{2,3},{4,5},{5,6},{6,7},{8,9},{9,10},{10,11},{12,13},{13,14},{14,15},
-					 {0,4},{4,8},{8,12},{1,5},{5,9},{9,13},{2,6},{6,10},{10,14},{3,7},{7,11},{11,15}};
-	controlSegments.resize(24);
-	for (int i = 0; i < 24; i++)
-		controlSegments[i] = int2(segs[i][0], segs[i][1]);
+void Blade::Draw(vec3 &color) {
+	if (!UseGouraud(false, vArrayId, format == VertexFloat? 5 : 2, BladeCurveyness(patches, npatches), this))
+		return;
+	gouraud->color.Set(color);
+	MultiDraw(false);
 }
 
+void Blade::UploadCage() {
+	// one copy per run of points that differ from those last uploaded
+	int n = 16*npatches;
+	bool all = (int) cage.size() != n;
+	cage.resize(n);
+	GLSL::BindBuffer(GL_ARRAY_BUFFER, cageBufferId);
+	for (int k = 0; k < n; ) {
+		int start = k;
+		for (; k < n; k++) {
+			vec3 &p = patches[k/16].pts[k%16/4][k%4].point;
+			if (!all && p.x == cage[k].x && p.y == cage[k].y && p.z == cage[k].z)
+				break;
+			cage[k] = p;
+		}
+		if (k > start)
+			glBufferSubData(GL_ARRAY_BUFFER, start*sizeof(vec3), (k-start)*sizeof(vec3), &cage[start]);
+		else
+			k++;
+	}
+}
+
+void Blade::DrawControlMesh(vec3 &lineColor, vec3 &dotColor) {
+	UseDrawShader(FullView);
+	UploadCage();
+	GLSL::BindVertexArray(cageArrayId);
+	glVertexAttrib1f(2, 7);
+	glVertexAttrib4f(1, dotColor.x, dotColor.y, dotColor.z, 1);
+	glVertexAttribI1ui(3, 0);
+	glDrawArrays(GL_POINTS, 0, 16*npatches);
+	glVertexAttrib4f(1, lineColor.x, lineColor.y, lineColor.z, 1);
+	glVertexAttribI1ui(3, DashCode());
+	glDrawElements(GL_LINES, nCageIndices, GL_UNSIGNED_SHORT, (void *) 0);
+	GLSL::BindVertexArray(0);
+}
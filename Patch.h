@@ -1,24 +1,21 @@
-// Patch.h
+// Patch.h - OpenGL layer over BezierPatch
 
-#include <vector>
-#include "mat.h"
+#include "Bezier.h"
 
-using std::vector;
-
-class Patch {
+class Patch : public BezierPatch {
 public:
-	struct patchPoints{
-		vec3 point;
-		vec3 origPoint;
-		float xresis;					// how resistant to being moved a point is in x-direction
-		float yresis;					// how resistant to being moved a point is in y-direction
-	};
-	patchPoints  pts[4][4];             // 16 control points, indexed by [s][t]
-	int          res;                   // res*res vertices
-	vector<int3> triangles;				// 2(res-1)**2 triangles
-	vector<int2> segments;				// triangle outlines
-	vector<int2> controlSegments;		// control mesh
 	unsigned int vBufferId;				// GPU vertex buffer
+	struct IndexBuffers *indices;		// GPU triangles, segments for this res, shared by patches
+	int          uploadedVersion;		// BezierPatch::version when last uploaded
+	bool         gpuBlend;				// buffer holds blend grids, curved in the vertex shader
+	class Blade *blade;					// if non-null, vertex buffer is shared with other patches
+	int          baseVertex;			// first vertex of this patch within each attribute stream
+	int          streamVerts;			// vertices per attribute stream in vBufferId
+	int          sliceVertex;			// in a blade: first vertex within each slot's slice
+	int          slot, slotFrame;		// in a blade: slice written last, and frame when chosen
+	vec3         boxCenter, boxScale;	// bounds of vertices as last packed (VertexHalf)
+	int          boxIndex;				// index of this patch's box in the shader (its blade index)
+	Patch();
 	void SetRes(int res);
 	void Init(int res, vec3 p0,  vec3 p1,  vec3 p2,  vec3 p3);
 		// create patch of 16 control points from quadrilateral
@@ -27,21 +24,70 @@ public:
 					   vec3 p8,  vec3 p9,  vec3 p10, vec3 p11,
 					   vec3 p12, vec3 p13, vec3 p14, vec3 p15);
 		// create patch given 16 control points
-	void SetVertices();
-	void SetTriangles();
-	void SetSegments();
-	void Reset();
-    void Shade(mat4 &modelview, mat4 &proj, vec3 &light, vec3 &color);
-	void Draw(mat4 &modelview, mat4 &proj, vec3 &color);
-	void DrawControlMesh(mat4 &fullview, vec3 &lineColor, vec3 &dotColor);
-	void SetControlSegments();
+	void Upload();
+		// copy vertices, normals to GPU vertex buffer
+	bool NeedsUpload();
+		// have vertices, normals changed since last Upload?
+	void UploadIndices();
+		// set indices, copying topology to GPU element buffers if first patch of this res
+	void UploadBlend();
+		// copy blend grids to GPU; until next Upload, the vertex shader applies blendK
+	// support
+	VertexFormat Format();
+		// blade's format, else VertexFloat
+	void Allocate(bool blend);
+		// (re)allocate own vertex buffer for blend or tessellated vertices
+	void WriteBytes(int offset, int size, void *data);
+	void WriteStream(int stream, vector<vec3> &data);
+	void WritePacked();
+		// copy vertices, normals to vBufferId in the blade's interleaved format
+	void NextSlot();
+		// in a blade, move to a slice the GPU is done with (once per frame)
+};
+
+void ReorderTriangles(TriangleOrder order);
+	// SetTriangleOrder, and re-upload the element buffers of all res in use
+
+// a blade is a set of patches sharing one vertex buffer, each patch at its own base vertex;
+// patches of equal res share element buffers and are drawn with one glMultiDrawElementsBaseVertex
+class Blade {
+public:
+	Patch       *patches;
+	int          npatches;
+	unsigned int vBufferId;
+	unsigned int vArrayId;
+	VertexFormat format;				// blend grids (GPU curve) require VertexFloat
+	bool         strips;				// shade with triangle strips and primitive restart
+	enum {MaxBoxes = 64};				// patches with VertexHalf, as sized in the vertex shader
+	enum {NSlots = 3};					// vertex slices cycled by uploads (frames in flight)
+	int          nVerts;				// vertices per slice, summed over patches
+	int          frame;					// count of EndFrame calls
+	GLsync       fences[NSlots];		// end of frame, by frame%NSlots
+	unsigned int cageBufferId;			// 16 control points per patch
+	unsigned int cageIndexId;			// controlSegments of all patches
+	unsigned int cageArrayId;
+	vector<vec3> cage;					// control points as last uploaded, 16 per patch
+	int          nCageIndices;
+	Blade();
+	void Init(Patch *patches, int npatches);
+		// move patches into a shared vertex buffer
+	void Layout();
+		// assign base vertices, (re)allocate buffer and upload all patches
+	void SetRes(int *res);
+		// as Patch::SetRes for each patch, laying out once
+	void SetFormat(VertexFormat format);
+		// re-layout with another vertex format; patches blended on the GPU are blended on the CPU
+	void BeginFrame();
+		// call before a frame's uploads: wait until slices about to be reused are no longer drawn
+	void EndFrame();
+		// call after a frame's draws
+	void Shade(vec3 &light, vec3 &color, vec3 *wireColor = NULL);
+	void Draw(vec3 &color);
+	void DrawControlMesh(vec3 &lineColor, vec3 &dotColor);
+		// all control meshes as one draw of points and one of dashed segments
 	// support
-	void UseShader(mat4 &modelview, mat4 &proj);
-	void SPts(float s, vec3 spts[]);
-	void TPts(float t, vec3 tpts[]);
-	// geometry
-	vec3 Point(float s, float t);
-	vec3 Normal(float s, float t);
-	void Eval(float s, float t, vec3 &point, vec3 &stan, vec3 &ttan, vec3 *normal = NULL);
-		// the tangent vectors are unit length
+	void MultiDraw(bool triangles);
+		// draw triangles or segments of all patches, one call per distinct res
+	void UploadCage();
+		// copy control points that differ from cage to cageBufferId
 };
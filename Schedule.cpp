@@ -0,0 +1,137 @@
+// Schedule.cpp - thread pool and parallel tessellation of patches
+
+#ifdef _WIN32
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <time.h>
+#endif
+#include "Schedule.h"
+
+// Thread Pool
+
+ThreadPool::ThreadPool(int nWorkers) : generation(0), nBusy(0), quit(false), nTasks(0), nextTask(0) {
+	if (nWorkers < 0)
+		nWorkers = (int) std::thread::hardware_concurrency()-1;
+	for (int i = 0; i < nWorkers; i++)
+		workers.push_back(std::thread(&ThreadPool::Work, this));
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	start.notify_all();
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+}
+
+int ThreadPool::NThreads() {
+	return workers.size()+1;
+}
+
+void ThreadPool::RunTasks() {
+	for (;;) {
+		int i;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (nextTask >= nTasks)
+				return;
+			i = nextTask++;
+		}
+		task(i, data);
+	}
+}
+
+void ThreadPool::Work() {
+	int seen = 0;
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while (!quit && generation == seen)
+				start.wait(lock);
+			if (quit)
+				return;
+			seen = generation;
+		}
+		RunTasks();
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--nBusy == 0)
+			done.notify_one();
+	}
+}
+
+void ThreadPool::ParallelFor(int n, void (*task)(int i, void *data), void *data) {
+	if (workers.empty() || n < 2) {
+		for (int i = 0; i < n; i++)
+			task(i, data);
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		this->task = task;
+		this->data = data;
+		nTasks = n;
+		nextTask = 0;
+		nBusy = workers.size();
+		generation++;
+	}
+	start.notify_all();
+	RunTasks();
+	std::unique_lock<std::mutex> lock(mutex);
+	while (nBusy > 0)
+		done.wait(lock);
+}
+
+// Parallel Tessellation
+
+struct TessJob {
+	BezierPatch **patches;
+	float k;
+};
+
+static void TessellateTask(int i, void *data) {
+	TessJob *job = (TessJob *) data;
+	job->patches[i]->Tessellate();
+}
+
+static void BlendTask(int i, void *data) {
+	TessJob *job = (TessJob *) data;
+	job->patches[i]->Blend(job->k);
+}
+
+static void Run(ThreadPool *pool, int n, void (*task)(int i, void *data), TessJob &job) {
+	if (pool)
+		pool->ParallelFor(n, task, &job);
+	else
+		for (int i = 0; i < n; i++)
+			task(i, &job);
+}
+
+void TessellatePatches(ThreadPool *pool, BezierPatch **patches, int npatches) {
+	TessJob job = {patches, 0};
+	Run(pool, npatches, TessellateTask, job);
+}
+
+void BlendPatches(ThreadPool *pool, BezierPatch **patches, int npatches, float k) {
+	TessJob job = {patches, k};
+	Run(pool, npatches, BlendTask, job);
+}
+
+// Timing
+
+double Seconds() {
+#ifdef _WIN32
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER count;
+	if (!frequency.QuadPart)
+		QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&count);
+	return (double) count.QuadPart/frequency.QuadPart;
+#else
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec+1e-9*now.tv_nsec;
+#endif
+}
@@ -0,0 +1,44 @@
+// Schedule.h - thread pool and parallel tessellation of patches
+
+#ifndef SCHEDULE_HDR
+#define SCHEDULE_HDR
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "Bezier.h"
+
+class ThreadPool {
+public:
+	ThreadPool(int nWorkers = -1);
+		// -1: one worker per hardware thread, less the calling thread, which also works
+	~ThreadPool();
+	int NThreads();
+		// workers plus the calling thread
+	void ParallelFor(int n, void (*task)(int i, void *data), void *data);
+		// call task(i, data) for i in [0, n) on the workers and the calling thread;
+		// return when all calls are done
+private:
+	vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable start, done;
+	int generation;						// incremented for each ParallelFor
+	int nBusy;							// workers yet to finish current generation
+	bool quit;
+	int nTasks, nextTask;				// task index range, next index to claim
+	void (*task)(int i, void *data);
+	void *data;
+	void Work();
+	void RunTasks();
+};
+
+void TessellatePatches(ThreadPool *pool, BezierPatch **patches, int npatches);
+	// set vertices, normals of each patch; serially if pool is NULL
+
+void BlendPatches(ThreadPool *pool, BezierPatch **patches, int npatches, float k);
+	// call Blend(k) for each patch; serially if pool is NULL
+
+double Seconds();
+	// high-resolution wall-clock time
+
+#endif
@@ -3,6 +3,7 @@
 //  All rights reserved
 
 #include "Draw.h"
+#include "GLSL.h"
 #include "Widget.h"
 #include "freeglut.h"
 
@@ -35,7 +36,8 @@ void Header::Draw()
 	int w = x2-x1+1, h = y2-y1+1;
 	if (title && *title) {
 		int margin = (w-strwid)/2;
-		glColor3fv(textColor);
+		if (!CoreProfile())
+			glColor3fv(textColor);
 		Text(x1+margin+4, y2-4, title);
 		Rect(x1, y2, margin, 1, dkGry);         // left-top
 		Rect(x2-margin, y2, margin, 1, dkGry);  // right-top
@@ -146,7 +148,8 @@ void Button::ShowName(char *name, float *color) {
 	bool singleLine = 9*nchars <= w; // assume 9by15 font
 	if (singleLine && h > 30)
 		ypos += (h-20)/2;
-	glColor3fv(color);
+	if (!CoreProfile())
+		glColor3fv(color);
 	if (type == B_Checkbox || type == B_Dot) {
 		char *cr = strchr(name, '\n'), buf[100];
 		int len = cr? cr-name : 0;
@@ -224,23 +227,28 @@ void Button::Draw(char *name, float *statusColor) {
 		winW = glutGet(GLUT_WINDOW_WIDTH);
 		winH = glutGet(GLUT_WINDOW_HEIGHT);
 	}
+	FlushDraw();	// state below applies to this button's primitives only
 
 	if (type == B_Tube || type == B_Dot) {
-		glEnable(GL_BLEND);
-		glEnable(GL_LINE_SMOOTH);
-		glEnable(GL_POINT_SMOOTH);
+		GLSL::Enable(GL_BLEND);
+		GLSL::Enable(GL_LINE_SMOOTH);
+		if (!CoreProfile())
+			GLSL::Enable(GL_POINT_SMOOTH);
 	}
 	else {
-		glDisable(GL_BLEND);
-		glDisable(GL_LINE_SMOOTH);
-		glDisable(GL_POINT_SMOOTH);
+		GLSL::Disable(GL_BLEND);
+		GLSL::Disable(GL_LINE_SMOOTH);
+		if (!CoreProfile())
+			GLSL::Disable(GL_POINT_SMOOTH);
 	}
-	glDisable(GL_DEPTH_TEST);
+	GLSL::Disable(GL_DEPTH_TEST);
 
 	if (type == B_Tube) {
-		glLineWidth(2.f*radius);
+		bool core = CoreProfile();	// no wide lines
+		glLineWidth(core? 1.f : 2.f*radius);
 		Line(x-(int)radius, y, x+(int)radius, y, backgroundColor, backgroundColor);
-		glLineWidth(2.f*radius-2.f);
+		FlushDraw();
+		glLineWidth(core? 1.f : 2.f*radius-2.f);
 		if (statusColor)
 			Line(x-(int)radius, y, x+(int)radius, y, statusColor, statusColor);
 	}
@@ -249,8 +257,9 @@ void Button::Draw(char *name, float *statusColor) {
 		statusColor? DrawDepressedBox(x, y, w, h) : DrawUnpressedBox(x, y, w, h);
 	}
 	if (type == B_Dot) {
-		glEnable(GL_BLEND);
-		glEnable(GL_POINT_SMOOTH);
+		GLSL::Enable(GL_BLEND);
+		if (!CoreProfile())
+			GLSL::Enable(GL_POINT_SMOOTH);
 		Disk(x, y, 2.f*radius, backgroundColor);
 		if (statusColor)
 			Disk(x, y, 1.3f*radius, statusColor);
@@ -289,6 +298,7 @@ void Button::Draw(char *name, float *statusColor) {
 
 void Button::Highlight() {
 	Rect(x, y, w, h, wht, true, .5f);
+	FlushDraw();
 	glLineWidth(1.f);
 	float x1 = (float)x, x2 = x1+(float)w, y1 = (float)y, y2 = y1+(float)h;
 	Line(x1+1, y1+1.5f, x2-1, y1+1.5f, blk, blk, 1);
@@ -340,7 +350,8 @@ void Slider::Draw(char *name, float *sliderColor) {
 
 	float xPos, yPos;
 	float *sCol = sliderColor? sliderColor : color;
-	glLineWidth(2);
+	FlushDraw();
+	glLineWidth(CoreProfile()? 1.f : 2.f);
 	int iloc = (int) loc;
 	if (orientation == Horizontal) {
 		Rect(x, y-10, size, 20, color, true, .5f);
@@ -374,7 +385,7 @@ void Slider::Draw(char *name, float *sliderColor) {
 		xPos = (2*(x+2))/(float)winW-1.f;
 		yPos = (2*(y+size-0))/(float)winH-1.f;
 	}
-	if (name) {
+	if (name && !CoreProfile()) {
 		if (winW == -1) {
 			winW = glutGet(GLUT_WINDOW_WIDTH);
 			winH = glutGet(GLUT_WINDOW_HEIGHT);
@@ -528,7 +539,8 @@ bool Typescript::Hit(int _x, int _y)
 void Typescript::Draw(float *color)
 {
 	DrawDepressedBox(x, y, w, h);
-    glColor3fv(color);
+	if (!CoreProfile())
+		glColor3fv(color);
     Text(x+5, y+6, text);
 }
 
@@ -0,0 +1,65 @@
+// StitchEdgesTest.cpp - boundary vertices of neighbouring patches agree as their res change
+
+#include <stdio.h>
+#include "Bezier.h"
+
+static float EdgeGap(BezierPatch &a, BezierPatch &b) {
+	// a's edge 1 (pts[3][m]) is b's edge 0 (pts[0][m]); largest distance between b's boundary
+	// vertices and a's boundary polyline at the same parameter
+	int ra = a.res, rb = b.res, ratio = (rb-1)/(ra-1);
+	float gap = 0;
+	for (int q = 0; q < rb; q++) {
+		int k = q/ratio, f = q%ratio;
+		vec3 v = a.vertices[k*ra+ra-1];
+		if (f)
+			v = v+((float) f/ratio)*(a.vertices[(k+1)*ra+ra-1]-v);
+		gap = std::max(gap, length(b.vertices[q*rb]-v));
+	}
+	return gap;
+}
+
+static bool Check(const char *step, float gap) {
+	printf("%-24s gap %g\n", step, gap);
+	return gap < 1e-6f;
+}
+
+int main() {
+	// two unit patches sharing a bent boundary at x = 1
+	BezierPatch a, b;
+	vec3 edge[] = {vec3(1, 0, 0), vec3(1, .33f, .5f), vec3(1, .67f, -.5f), vec3(1, 1, 0)};
+	a.Init(5, vec3(0, 0, 0), vec3(0, .33f, 0), vec3(0, .67f, 0), vec3(0, 1, 0),
+			  vec3(.33f, 0, 0), vec3(.33f, .33f, .2f), vec3(.33f, .67f, -.2f), vec3(.33f, 1, 0),
+			  vec3(.67f, 0, 0), vec3(.67f, .33f, .4f), vec3(.67f, .67f, -.4f), vec3(.67f, 1, 0),
+			  edge[0], edge[1], edge[2], edge[3]);
+	b.Init(5, edge[0], edge[1], edge[2], edge[3],
+			  vec3(1.33f, 0, 0), vec3(1.33f, .33f, .4f), vec3(1.33f, .67f, -.4f), vec3(1.33f, 1, 0),
+			  vec3(1.67f, 0, 0), vec3(1.67f, .33f, .2f), vec3(1.67f, .67f, -.2f), vec3(1.67f, 1, 0),
+			  vec3(2, 0, 0), vec3(2, .33f, 0), vec3(2, .67f, 0), vec3(2, 1, 0));
+	BezierPatch *patches[] = {&a, &b};
+	vector<SharedEdge> edges;
+	FindSharedEdges(patches, 2, edges);
+	if (edges.size() != 1) {
+		printf("expected 1 shared edge, found %i\n", (int) edges.size());
+		return 1;
+	}
+	vector<bool> changed(2, true);
+	bool ok = true;
+	// coarse to fine: b's boundary interpolates a's
+	b.SetRes(9);
+	StitchEdges(patches, edges, changed);
+	ok = Check("a res 5, b res 9", EdgeGap(a, b)) && ok;
+	// equal: a refined and re-tessellated, b untouched since it was stitched
+	a.SetRes(9);
+	changed[0] = true;
+	changed[1] = false;
+	StitchEdges(patches, edges, changed);
+	ok = Check("a res 9, b res 9", EdgeGap(a, b)) && ok;
+	// fine to coarse: a's boundary interpolates b's
+	b.SetRes(17);
+	changed[0] = false;
+	changed[1] = true;
+	StitchEdges(patches, edges, changed);
+	ok = Check("a res 9, b res 17", EdgeGap(a, b)) && ok;
+	printf(ok? "passed\n" : "FAILED\n");
+	return ok? 0 : 1;
+}
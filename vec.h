@@ -15,9 +15,13 @@
 #  define M_PI  3.14159265358979323846
 #endif
 
+#ifdef HEADLESS
+typedef float GLfloat;	// geometry core, built without OpenGL
+#else
 #  include "GL/glew.h"
 #  include "GL/freeglut.h"
 #  include "GL/freeglut_ext.h"
+#endif
 
 const GLfloat  DivideByZeroTolerance = GLfloat(1.0e-07);
 const GLfloat  DegreesToRadians = (float) M_PI / 180.0f;